@@ -0,0 +1,103 @@
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <format>
+#include <print>
+#include <random>
+#include <string>
+#include <vector>
+#include <sstable.hpp>
+
+// compares point lookup latency against full-table scan throughput for several block sizes,
+// then string keys against U64Key for the same integer ids
+// usage: bench [num_keys] [value_size]
+
+static std::string key(size_t i) { return std::format("key{:010d}", i); }
+
+int main(int argc, char **argv) {
+    size_t num_keys = argc > 1 ? std::stoul(argv[1]) : 200000;
+    size_t value_size = argc > 2 ? std::stoul(argv[2]) : 100;
+    constexpr size_t lookups = 20000;
+
+    auto directory = std::filesystem::temp_directory_path() / "microdb-bench";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+
+    std::println("keys={0} value_size={1} lookups={2}", num_keys, value_size, lookups);
+    std::println("{0:>10} {1:>10} {2:>14} {3:>14} {4:>12}", "block", "blocks", "lookup ns/op", "scan MB/s", "file MB");
+
+    std::string value(value_size, 'v');
+    std::mt19937_64 rng(42);
+    std::vector<size_t> probes(lookups);
+    for (auto& p: probes) p = rng() % num_keys;
+
+    for (size_t block_size: {4096, 16384, 65536, 262144}) {
+        auto path = directory / std::format("bench-{0}.sst", block_size);
+        SSTable table;
+        {
+            SSTableWriter writer(path, 1, block_size);
+            for (size_t i = 0; i < num_keys; i++) {
+                writer.add(key(i), value);
+            }
+            table = writer.finish();
+        }
+        size_t file_size = std::filesystem::file_size(path);
+
+        auto start = std::chrono::steady_clock::now();
+        size_t found = 0;
+        for (auto p: probes) {
+            found += table.get(key(p), ChecksumVerification::OnFirstLoad).has_value();
+        }
+        auto lookup_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / lookups;
+
+        start = std::chrono::steady_clock::now();
+        size_t scanned = 0;
+        table.scan([&](std::string_view, const Entry&) { scanned++; });
+        auto scan_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (found != lookups || scanned != num_keys) {
+            std::println("block size {0}: expected {1} hits and {2} entries, got {3} and {4}",
+                         block_size, lookups, num_keys, found, scanned);
+            return 1;
+        }
+        std::println("{0:>10} {1:>10} {2:>14.0f} {3:>14.1f} {4:>12.1f}", block_size, file_size / block_size,
+                     lookup_ns, file_size / scan_s / 1e6, file_size / 1e6);
+    }
+
+    // the string table holds the same ids as zero padded decimal so both sort alike
+    std::println("{0:>10} {1:>14} {2:>14}", "codec", "memtable ns/op", "lookup ns/op");
+    auto codec_bench = [&]<typename Codec>(const char *name, auto make_key) {
+        MemTable<Mutable, Codec> memtable(1);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < num_keys; i++) {
+            memtable.put(make_key(i), value);
+        }
+        for (auto p: probes) {
+            memtable.get(make_key(p));
+        }
+        auto memtable_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+                           (num_keys + lookups);
+
+        auto table = BasicSSTable<Codec>::from_memtable(1, directory, memtable.freeze());
+        start = std::chrono::steady_clock::now();
+        size_t found = 0;
+        for (auto p: probes) {
+            found += table.get(make_key(p), ChecksumVerification::OnFirstLoad).has_value();
+        }
+        auto lookup_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / lookups;
+        std::filesystem::remove(directory / "sstable-1.sst");
+        if (found != lookups) {
+            std::println("{0}: expected {1} hits, got {2}", name, lookups, found);
+            return false;
+        }
+        std::println("{0:>10} {1:>14.0f} {2:>14.0f}", name, memtable_ns, lookup_ns);
+        return true;
+    };
+    if (!codec_bench.operator()<StringKey>("string", key) ||
+        !codec_bench.operator()<U64Key>("u64", [](size_t i) { return static_cast<uint64_t>(i); })) {
+        return 1;
+    }
+
+    std::filesystem::remove_all(directory);
+    return 0;
+}
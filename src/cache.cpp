@@ -0,0 +1,107 @@
+#include "include/cache.hpp"
+#include <algorithm>
+#include <functional>
+#include <mutex>
+
+RowCache::RowCache(size_t capacity_bytes): shard_capacity_{capacity_bytes / NUM_SHARDS} {}
+
+RowCache::Shard& RowCache::shard(const std::string& key) {
+    return shards_[std::hash<std::string>{}(key) % NUM_SHARDS];
+}
+
+std::optional<std::string> RowCache::get(const std::string& key, size_t& generation) {
+    auto& s = shard(key);
+    std::lock_guard<std::mutex> g{s.m_};
+    auto it = s.index_.find(key);
+    if (it == s.index_.end()) {
+        generation = s.generation_;
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return std::nullopt;
+    }
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    s.lru_.splice(s.lru_.begin(), s.lru_, it->second);
+    return it->second->second;
+}
+
+void RowCache::insert(const std::string& key, const std::string& value, size_t generation) {
+    size_t charge = key.size() + value.size();
+    size_t capacity = shard_capacity_.load(std::memory_order_relaxed);
+    if (charge > capacity) return;
+    auto& s = shard(key);
+    std::lock_guard<std::mutex> g{s.m_};
+    if (s.generation_ != generation) return;
+    auto it = s.index_.find(key);
+    if (it != s.index_.end()) {
+        size_t old = it->first.size() + it->second->second.size();
+        s.size_ -= old;
+        size_bytes_.fetch_sub(old, std::memory_order_relaxed);
+        s.lru_.erase(it->second);
+        s.index_.erase(it);
+    }
+    s.lru_.emplace_front(key, value);
+    s.index_[key] = s.lru_.begin();
+    s.size_ += charge;
+    size_bytes_.fetch_add(charge, std::memory_order_relaxed);
+    inserts_.fetch_add(1, std::memory_order_relaxed);
+    evict(s, capacity);
+}
+
+void RowCache::invalidate(const std::string& key) {
+    auto& s = shard(key);
+    std::lock_guard<std::mutex> g{s.m_};
+    s.generation_++;
+    auto it = s.index_.find(key);
+    if (it != s.index_.end()) {
+        size_t old = it->first.size() + it->second->second.size();
+        s.size_ -= old;
+        size_bytes_.fetch_sub(old, std::memory_order_relaxed);
+        s.lru_.erase(it->second);
+        s.index_.erase(it);
+    }
+}
+
+void RowCache::clear() {
+    for (auto& s: shards_) {
+        std::lock_guard<std::mutex> g{s.m_};
+        s.generation_++;
+        s.lru_.clear();
+        s.index_.clear();
+        size_bytes_.fetch_sub(s.size_, std::memory_order_relaxed);
+        s.size_ = 0;
+    }
+}
+
+void RowCache::shrink(size_t target_bytes) {
+    // only ever lowered, so a concurrent shrink to a larger target cannot undo a smaller one
+    size_t capacity = target_bytes / NUM_SHARDS;
+    size_t current = shard_capacity_.load(std::memory_order_relaxed);
+    while (capacity < current && !shard_capacity_.compare_exchange_weak(current, capacity, std::memory_order_relaxed)) {
+    }
+    capacity = std::min(capacity, current);
+    for (auto& s: shards_) {
+        std::lock_guard<std::mutex> g{s.m_};
+        evict(s, capacity);
+    }
+}
+
+void RowCache::evict(Shard& s, size_t capacity) {
+    while (s.size_ > capacity && !s.lru_.empty()) {
+        auto& [k, v] = s.lru_.back();
+        s.size_ -= k.size() + v.size();
+        size_bytes_.fetch_sub(k.size() + v.size(), std::memory_order_relaxed);
+        s.index_.erase(k);
+        s.lru_.pop_back();
+        evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+RowCacheStats RowCache::stats() const {
+    return RowCacheStats{
+        hits_.load(std::memory_order_relaxed),
+        misses_.load(std::memory_order_relaxed),
+        inserts_.load(std::memory_order_relaxed),
+        evictions_.load(std::memory_order_relaxed),
+        size_bytes_.load(std::memory_order_relaxed),
+        shard_capacity_.load(std::memory_order_relaxed) * NUM_SHARDS,
+    };
+}
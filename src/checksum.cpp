@@ -0,0 +1,108 @@
+#include "include/checksum.hpp"
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+namespace checksum {
+    namespace {
+        constexpr uint32_t POLY = 0x82F63B78; // reflected Castagnoli polynomial
+
+        // slicing-by-8 tables for the software fallback
+        constexpr std::array<std::array<uint32_t, 256>, 8> make_tables() {
+            std::array<std::array<uint32_t, 256>, 8> t{};
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t crc = i;
+                for (int j = 0; j < 8; j++) {
+                    crc = (crc >> 1) ^ ((crc & 1) ? POLY : 0);
+                }
+                t[0][i] = crc;
+            }
+            for (uint32_t i = 0; i < 256; i++) {
+                for (size_t k = 1; k < 8; k++) {
+                    t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+                }
+            }
+            return t;
+        }
+        constexpr auto TABLES = make_tables();
+
+        uint32_t crc32c_sw(uint32_t crc, const std::byte *p, size_t n) {
+            while (n >= 8) {
+                uint64_t word;
+                std::memcpy(&word, p, 8);
+                word ^= crc;
+                crc = TABLES[7][word & 0xFF] ^ TABLES[6][(word >> 8) & 0xFF] ^
+                      TABLES[5][(word >> 16) & 0xFF] ^ TABLES[4][(word >> 24) & 0xFF] ^
+                      TABLES[3][(word >> 32) & 0xFF] ^ TABLES[2][(word >> 40) & 0xFF] ^
+                      TABLES[1][(word >> 48) & 0xFF] ^ TABLES[0][word >> 56];
+                p += 8;
+                n -= 8;
+            }
+            while (n--) {
+                crc = (crc >> 8) ^ TABLES[0][(crc ^ static_cast<uint8_t>(*p++)) & 0xFF];
+            }
+            return crc;
+        }
+
+#if defined(__x86_64__)
+        __attribute__((target("sse4.2")))
+        uint32_t crc32c_hw(uint32_t crc, const std::byte *p, size_t n) {
+            uint64_t crc64 = crc;
+            while (n >= 8) {
+                uint64_t word;
+                std::memcpy(&word, p, 8);
+                crc64 = _mm_crc32_u64(crc64, word);
+                p += 8;
+                n -= 8;
+            }
+            crc = static_cast<uint32_t>(crc64);
+            while (n--) {
+                crc = _mm_crc32_u8(crc, static_cast<uint8_t>(*p++));
+            }
+            return crc;
+        }
+
+        bool detect() {
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse4.2");
+        }
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+        uint32_t crc32c_hw(uint32_t crc, const std::byte *p, size_t n) {
+            while (n >= 8) {
+                uint64_t word;
+                std::memcpy(&word, p, 8);
+                crc = __crc32cd(crc, word);
+                p += 8;
+                n -= 8;
+            }
+            while (n--) {
+                crc = __crc32cb(crc, static_cast<uint8_t>(*p++));
+            }
+            return crc;
+        }
+
+        bool detect() { return true; }
+#else
+        uint32_t crc32c_hw(uint32_t crc, const std::byte *p, size_t n) { return crc32c_sw(crc, p, n); }
+
+        bool detect() { return false; }
+#endif
+
+        const bool HARDWARE = detect();
+    }
+
+    uint32_t crc32c(std::span<const std::byte> data) {
+        uint32_t crc = 0xFFFFFFFF;
+        crc = HARDWARE ? crc32c_hw(crc, data.data(), data.size()) : crc32c_sw(crc, data.data(), data.size());
+        return crc ^ 0xFFFFFFFF;
+    }
+
+    bool hardware_accelerated() {
+        return HARDWARE;
+    }
+}
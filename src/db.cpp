@@ -1,126 +1,273 @@
 #include "include/db.hpp"
 #include "logging.hpp"
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <filesystem>
+#include <future>
 #include <print>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <shared_mutex>
 #include <stdexcept>
 #include <ranges>
 #include <thread>
 #include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
 
-void flush_thread_func(LSMKVStore& store) {
-    // block on channel and flush 
-    while (true) {
-        auto item = store.flush_channel_.receive();
-        if (item == Stop) {
+// flushes the oldest immutable memtables into one table, one job is scheduled per frozen memtable
+// a job coalesces everything queued when it runs, so the jobs scheduled for memtables it took become no-ops
+template<typename Codec>
+void flush_job(BasicLSMKVStore<Codec>& store) {
+    logging::log("flushing");
+
+    // only flushes and ingest remove immutable memtables, so the ones taken here stay
+    // at the front of the queue until the commit, while writers keep going
+    std::lock_guard<std::mutex> flush_guard{store.flush_lock_};
+
+    // prepare, the snapshot keeps the memtables alive while they are written
+    store.snapshot_lock_.lock_shared();
+    auto snapshot = store.state_;
+    store.snapshot_lock_.unlock_shared();
+    if (snapshot->immutable_memtables_.empty()) {
+        // already flushed by ingest or an earlier job
+        return;
+    }
+    // always take the oldest, then newer ones while they fit the limit
+    std::vector<const MemTable<Immutable, Codec>*> memtables;
+    size_t bytes = 0;
+    size_t limit = store.config_.flush_coalesce_bytes_;
+    for (auto const& memtable: snapshot->immutable_memtables_) {
+        if (!memtables.empty() && limit > 0 && bytes + memtable.size_ > limit) {
             break;
         }
+        memtables.push_back(&memtable);
+        bytes += memtable.size_;
+    }
+    // newer than every table on disk and older than every memtable left in memory
+    size_t id = memtables.back()->id_;
+    BasicSSTable<Codec> sstable;
+    try {
+        // every table in the snapshot is older than the memtables being flushed
+        auto older_value = [&](const typename Codec::Key& k) { return store.read_tables(*snapshot, k, {}); };
+        sstable = BasicSSTable<Codec>::from_memtables(id, store.config_.directory_, memtables, store.config_.merge_operator_,
+                                                      store.config_.block_size_, store.rate_limiter_.get(), older_value);
+    } catch (const std::exception& e) {
+        // the memtables stay queued, later jobs and the destructor try again,
+        // but writes fail from now on rather than pile up in memory
+        logging::log(std::format("Flush of memtable {0} failed: {1}", id, e.what()));
+        store.fail_flushes(e.what());
+        if (store.config_.memory_budget_) {
+            store.config_.memory_budget_->released();
+        }
+        return;
+    }
 
-        logging::log("flushing");
-
-        store.state_lock_.lock();
+    // commit
+    store.state_lock_.lock();
+    store.snapshot_lock_.lock();
+    auto state = *store.state_;
+    state.immutable_memtables_.erase(state.immutable_memtables_.begin(),
+                                     state.immutable_memtables_.begin() + memtables.size());
+    state.sstables_[sstable.id()] = std::move(sstable);
+    store.state_ = std::make_shared<LSMStoreState<Codec>>(std::move(state));
+    store.account(*store.state_);
+    store.snapshot_lock_.unlock();
 
-        // prepare
-        store.snapshot_lock_.lock_shared();
-        auto snapshot = store.state_;
-        store.snapshot_lock_.unlock_shared();
-        auto memtable = snapshot->immutable_memtables_.front();
-        auto sstable = SSTable::from_memtable(memtable.id(), store.config_.directory_, memtable);
+    store.state_lock_.unlock();
 
-        // commit
-        store.snapshot_lock_.lock();
-        auto state = *store.state_;
-        state.immutable_memtables_.pop_front();
-        state.sstables_[sstable.id()] = std::move(sstable);
-        store.state_ = std::make_shared<LSMStoreState>(std::move(state));
-        store.snapshot_lock_.unlock();
-        
-        
-        store.state_lock_.unlock();
+    if (store.config_.memory_budget_) {
+        store.config_.memory_budget_->released();
     }
 }
 
-LSMStoreState LSMStoreState::open_dir(std::filesystem::path directory) {
+template<typename Codec>
+LSMStoreState<Codec> LSMStoreState<Codec>::open_dir(std::filesystem::path directory) {
     LSMStoreState state;
     for (auto const& entry: std::filesystem::directory_iterator(directory)) {
         auto path = entry.path();
-        // assuming the database is being used correctly, path should be an SSTable
-        SSTable table = SSTable::from_file(path);
+        // skip tables a writer has not finished yet
+        if (!BasicSSTable<Codec>::is_table_file(path)) {
+            continue;
+        }
+        BasicSSTable<Codec> table = BasicSSTable<Codec>::from_file(path);
         size_t id = table.id();
         state.sstables_[id] = std::move(table);
-        state.next_table_id_ = std::max(state.next_table_id_, table.id() + 1);
+        state.next_table_id_ = std::max(state.next_table_id_, id + 1);
     }
+    // the active memtable must be newer than every table on disk
+    state.memtable_ = MemTable<Mutable, Codec>(state.next_table_id());
     return state;
 }
 
-LSMKVStore::LSMKVStore(const KVStoreConfig& config)
-    : config_{config}, flush_thead_{} {
+template<typename Codec>
+BasicLSMKVStore<Codec>::BasicLSMKVStore(const KVStoreConfig& config)
+    : config_{config}, scheduler_{config.background_threads_} {
+    if (config_.block_size_ < MIN_BLOCK_SIZE || config_.block_size_ > MAX_BLOCK_SIZE) {
+        throw std::invalid_argument(std::format("Invalid block size {0}", config_.block_size_));
+    }
+    if (config_.follow_primary_ && !config_.read_only_) {
+        throw std::invalid_argument("follow_primary_ requires read_only_");
+    }
+    if (config_.read_only_ && !std::filesystem::is_directory(config_.directory_)) {
+        throw std::runtime_error(std::format("Cannot open missing directory {0} read-only", config_.directory_.string()));
+    }
     if (std::filesystem::exists(config_.directory_)) {
         // read all SSTables
-        state_ = std::make_shared<LSMStoreState>(LSMStoreState::open_dir(config_.directory_));
+        state_ = std::make_shared<LSMStoreState<Codec>>(LSMStoreState<Codec>::open_dir(config_.directory_));
     } else {
         if (!std::filesystem::create_directories(config_.directory_)) {
             throw new std::runtime_error("Failed to create directory");
         }
-        state_ = std::make_shared<LSMStoreState>();
+        state_ = std::make_shared<LSMStoreState<Codec>>();
+    }
+
+    if (config_.row_cache_bytes_ > 0) {
+        row_cache_ = std::make_unique<RowCache>(config_.row_cache_bytes_);
     }
 
-    // launch flush thread
-    flush_thead_ = std::jthread([&]{ flush_thread_func(*this); });
+    account(*state_);
+    if (config_.memory_budget_) {
+        config_.memory_budget_->attach(this);
+    }
+
+    if (config_.background_write_bytes_per_sec_ > 0) {
+        rate_limiter_ = std::make_unique<RateLimiter>(config_.background_write_bytes_per_sec_);
+    }
+
+    // last, the watcher publishes states as soon as it runs
+    if (config_.follow_primary_) {
+        watcher_ = std::jthread([this](std::stop_token stop) { follow_primary(stop); });
+    }
 }
 
-std::optional<std::string> LSMKVStore::get(std::string k) {
+template<typename Codec>
+std::optional<std::string> BasicLSMKVStore<Codec>::get(Key k) {
+    // every write invalidates its key, so a cached row is always the newest value
+    size_t cache_generation = 0;
+    if (row_cache_) {
+        auto cached = row_cache_->get(Codec::encode(k), cache_generation);
+        if (cached.has_value()) {
+            return cached;
+        }
+    }
+
     // take read lock and read snapshot
     snapshot_lock_.lock_shared();
     auto snapshot = state_;
     snapshot_lock_.unlock_shared();
 
+    // merge operands seen so far, oldest first; every level searched is newer than the next one
+    std::vector<std::string> operands;
+    // consumes one level's entry, true once a base value settles the lookup
+    auto visit = [&](const Entry& entry) {
+        operands.insert(operands.begin(), entry.operands.begin(), entry.operands.end());
+        return entry.value.has_value();
+    };
+
     auto result = snapshot->memtable_.get(k);
-    if (result.has_value()) {
-        if (result.value().length() == 0) {
-            return std::nullopt;
-        }
-        return result.value();
+    if (result.has_value() && visit(result.value())) {
+        return resolve(k, result->value, operands);
     }
 
     // search immutable memtables
     for (auto& memtable: snapshot->immutable_memtables_ | std::views::reverse) {
         auto result = memtable.get(k);
-        if (result.has_value()) {
-            if (result.value().length() == 0) {
-                return std::nullopt;
-            }
-            return result.value();
+        if (result.has_value() && visit(result.value())) {
+            return resolve(k, result->value, operands);
         }
     }
 
-    // search SSTables
+    auto value = read_tables(*snapshot, k, std::move(operands));
+    if (value.has_value() && row_cache_) {
+        row_cache_->insert(Codec::encode(k), value.value(), cache_generation);
+        if (config_.memory_budget_) {
+            config_.memory_budget_->enforce(this);
+        }
+    }
+    return value;
+}
+
+template<typename Codec>
+std::optional<std::string> BasicLSMKVStore<Codec>::read_tables(LSMStoreState<Codec>& state, const Key& k,
+                                                               std::vector<std::string> operands) {
     // iterate in reverse to get more recent tables first
-    for (auto& [_, sstable]: snapshot->sstables_ | std::views::reverse) {
-        auto res = sstable.get(k);
+    std::optional<std::string> base;
+    for (auto& [_, sstable]: state.sstables_ | std::views::reverse) {
+        auto res = sstable.get(k, config_.checksum_verification_);
         if (res.has_value()) {
-            // tombstone is 0-length value
-            if (res.value().length() == 0) {
-                return std::nullopt;
+            operands.insert(operands.begin(), res->operands.begin(), res->operands.end());
+            if (res->value.has_value()) {
+                base = res->value;
+                break;
             }
-            return res;
         }
     }
-    return std::nullopt;
+    return resolve(k, base, operands);
+}
+
+template<typename Codec>
+std::optional<std::string> BasicLSMKVStore<Codec>::resolve(const Key& k, std::optional<std::string> base,
+                                                           const std::vector<std::string>& operands) const {
+    // tombstone is 0-length value
+    if (base.has_value() && base.value().length() == 0) {
+        base = std::nullopt;
+    }
+    if (operands.empty()) {
+        return base;
+    }
+    if (!config_.merge_operator_) {
+        throw std::logic_error("Merge operands present but no merge operator configured");
+    }
+    auto merged = config_.merge_operator_(Codec::encode(k), base, operands);
+    // a flush stores an empty result as a tombstone, so it must read as one here too
+    if (merged.empty()) {
+        return std::nullopt;
+    }
+    return merged;
+}
+
+template<typename Codec>
+void BasicLSMKVStore<Codec>::check_writable() {
+    if (config_.read_only_) {
+        throw std::logic_error("Cannot write to a read-only store");
+    }
+    if (flush_failed_.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> g{flush_error_lock_};
+        throw std::runtime_error(std::format("Background flush failed: {0}", flush_error_));
+    }
+}
 
+template<typename Codec>
+void BasicLSMKVStore<Codec>::fail_flushes(const std::string& error) {
+    std::lock_guard<std::mutex> g{flush_error_lock_};
+    if (!flush_failed_.load(std::memory_order_relaxed)) {
+        flush_error_ = error;
+        flush_failed_.store(true, std::memory_order_release);
+    }
 }
 
-void LSMKVStore::put(std::string k, std::string v) {
+template<typename Codec>
+bool BasicLSMKVStore<Codec>::flush_failed() {
+    return flush_failed_.load(std::memory_order_acquire);
+}
+
+template<typename Codec>
+template<typename F>
+void BasicLSMKVStore<Codec>::write(F&& f) {
+    check_writable();
     // need to take read lock on current snapshot
     bool may_flush = false;
 
     state_lock_.lock_shared();
     snapshot_lock_.lock_shared();
     auto snapshot = state_;
-    snapshot->memtable_.put(k, v);
+    f(snapshot->memtable_);
     if (snapshot->memtable_.size_bytes() > config_.memtable_threshold_) {
         may_flush = true;
     }
@@ -128,10 +275,18 @@ void LSMKVStore::put(std::string k, std::string v) {
     state_lock_.unlock_shared();
 
     // fast path, may_flush is false (definitely no need to flush)
-    if (!may_flush) {
-        return;
+    // otherwise recheck and freeze under the global lock
+    if (may_flush) {
+        freeze_memtable(config_.memtable_threshold_);
     }
 
+    if (config_.memory_budget_) {
+        config_.memory_budget_->enforce(this);
+    }
+}
+
+template<typename Codec>
+void BasicLSMKVStore<Codec>::freeze_memtable(size_t min_bytes) {
     // slow path, have to take global lock and check again whether to flush
     // this lock ensures that no two threads will perform the recheck concurrently
     state_lock_.lock();
@@ -151,9 +306,9 @@ void LSMKVStore::put(std::string k, std::string v) {
     // this locking approach allows us to create the MemTable (and WAL) outside the lock
     // though perhaps it's better to create a placeholder memtable and put in the ID laterx`
 
-    if (slowpath_snapshot->memtable_.size_bytes() > this->config_.memtable_threshold_) {
+    if (slowpath_snapshot->memtable_.size_bytes() > min_bytes) {
 
-        auto memtable = MemTable<Mutable>(slowpath_snapshot->next_table_id());
+        auto memtable = MemTable<Mutable, Codec>(slowpath_snapshot->next_table_id());
         // the entire read-modify-write on the state is done under the exclusive lock
         // to prevent modifications to the memtable in between the read and write
         snapshot_lock_.lock();
@@ -161,24 +316,377 @@ void LSMKVStore::put(std::string k, std::string v) {
         state.immutable_memtables_.push_back(state.memtable_.freeze()); // technically this involves a lock but it will be unlocked
         state.memtable_ = std::move(memtable);
         logging::log(std::format("Memtable ID: {0}", memtable.id()));
-        state_ = std::make_shared<LSMStoreState>(std::move(state));
+        state_ = std::make_shared<LSMStoreState<Codec>>(std::move(state));
+        account(*state_);
         snapshot_lock_.unlock();
 
-        flush_channel_.send(Flush);        
+        scheduler_.schedule(JobPriority::High, [this] { flush_job(*this); });
     }
 
     state_lock_.unlock();
 }
 
-void LSMKVStore::remove(std::string k) {
+template<typename Codec>
+void BasicLSMKVStore<Codec>::put(Key k, std::string v) {
+    check_writable();
+    // reject entries the flush could not fit into a data block
+    if (8 + Codec::size(k) + v.size() > config_.block_size_ - BLOCK_TRAILER_SIZE) {
+        throw std::invalid_argument(std::format("Entry of {0} bytes does not fit in a {1} byte block",
+                                                8 + Codec::size(k) + v.size(), config_.block_size_));
+    }
+    write([&](MemTable<Mutable, Codec>& memtable) { memtable.put(k, v); });
+    if (row_cache_) {
+        row_cache_->invalidate(Codec::encode(k));
+    }
+}
+
+template<typename Codec>
+void BasicLSMKVStore<Codec>::remove(Key k) {
     // set a tombstone value
     this->put(k, "");
 }
 
-LSMKVStore::~LSMKVStore() {
-    flush_channel_.send(Stop);
-    // flush_thead_.join();
-    if (state_->memtable_.size_bytes() > 0) {
-        auto _ = SSTable::from_memtable(state_->next_table_id(), this->config_.directory_, state_->memtable_.freeze());
+template<typename Codec>
+void BasicLSMKVStore<Codec>::merge(Key k, std::string operand) {
+    check_writable();
+    if (!config_.merge_operator_) {
+        throw std::logic_error("LSMKVStore::merge requires a merge operator in KVStoreConfig");
+    }
+    write([&](MemTable<Mutable, Codec>& memtable) { memtable.merge(k, operand); });
+    if (row_cache_) {
+        row_cache_->invalidate(Codec::encode(k));
+    }
+}
+
+template<typename Codec>
+void BasicLSMKVStore<Codec>::remove_range(Key begin, Key end) {
+    write([&](MemTable<Mutable, Codec>& memtable) { memtable.remove_range(begin, end); });
+    // the cache is hashed, so a range can only be invalidated wholesale
+    if (row_cache_) {
+        row_cache_->clear();
+    }
+}
+
+template<typename Codec>
+std::optional<RowCacheStats> BasicLSMKVStore<Codec>::row_cache_stats() const {
+    if (!row_cache_) {
+        return std::nullopt;
+    }
+    return row_cache_->stats();
+}
+
+template<typename Codec>
+void BasicLSMKVStore<Codec>::ingest(const std::vector<std::filesystem::path>& paths) {
+    check_writable();
+    // validate every file before touching the store
+    for (auto const& path: paths) {
+        BasicSSTable<Codec>::from_file(path);
+    }
+
+    // excludes flushes and writers for the whole ingestion
+    std::lock_guard<std::mutex> flush_guard{flush_lock_};
+    state_lock_.lock();
+
+    snapshot_lock_.lock_shared();
+    auto state = *state_;
+    snapshot_lock_.unlock_shared();
+
+    // ingested tables are newer than everything written so far, so memtable contents
+    // have to reach disk first or they would shadow the ingested data
+    if (state.memtable_.size_bytes() > 0) {
+        state.immutable_memtables_.push_back(state.memtable_.freeze());
+    }
+    // publishes tables and the flushed memtables, with a new active memtable newer than every id handed out
+    auto commit = [&](std::vector<BasicSSTable<Codec>>& tables) {
+        state.immutable_memtables_.clear();
+        for (auto& table: tables) {
+            size_t id = table.id();
+            state.sstables_[id] = std::move(table);
+        }
+        state.memtable_ = MemTable<Mutable, Codec>(state.next_table_id());
+
+        snapshot_lock_.lock();
+        state_ = std::make_shared<LSMStoreState<Codec>>(std::move(state));
+        account(*state_);
+        snapshot_lock_.unlock();
+    };
+
+    // external files are staged first and only published once all of them are in the directory,
+    // so a failure leaves none of them behind that open_dir would load
+    std::vector<BasicSSTable<Codec>> tables;
+    std::vector<std::filesystem::path> staged;
+    std::optional<std::filesystem::path> memtable_table;
+    try {
+        if (!state.immutable_memtables_.empty()) {
+            std::vector<const MemTable<Immutable, Codec>*> memtables;
+            for (auto const& memtable: state.immutable_memtables_) {
+                memtables.push_back(&memtable);
+            }
+            auto older_value = [&](const Key& k) { return read_tables(state, k, {}); };
+            tables.push_back(BasicSSTable<Codec>::from_memtables(memtables.back()->id_, config_.directory_, memtables,
+                                                     config_.merge_operator_, config_.block_size_, nullptr, older_value));
+            memtable_table = tables.back().path();
+        }
+        for (auto const& path: paths) {
+            staged.push_back(BasicSSTable<Codec>::stage_external_file(path, config_.directory_, state.next_table_id()));
+        }
+        for (auto const& path: staged) {
+            tables.push_back(BasicSSTable<Codec>::publish_external_file(path));
+        }
+    } catch (...) {
+        std::error_code ec;
+        // hand every external file back, whether it was published already or not
+        for (size_t i = 0; i < staged.size(); i++) {
+            auto current = staged[i];
+            if (!std::filesystem::exists(current, ec)) {
+                current.replace_extension();
+            }
+            BasicSSTable<Codec>::unstage_external_file(current, paths[i]);
+        }
+        // a follower may already have loaded any table published here, so no id handed out is reused:
+        // the table written from the memtables stays, committed like a flush, and the ids of the
+        // external files are skipped
+        if (memtable_table.has_value() || !staged.empty()) {
+            tables.resize(memtable_table.has_value() ? 1 : 0);
+            commit(tables);
+        }
+        state_lock_.unlock();
+        throw;
+    }
+
+    commit(tables);
+
+    if (row_cache_) {
+        row_cache_->clear();
+    }
+
+    state_lock_.unlock();
+}
+
+template<typename Codec>
+std::vector<size_t> BasicLSMKVStore<Codec>::verify_all() {
+    snapshot_lock_.lock_shared();
+    auto snapshot = state_;
+    snapshot_lock_.unlock_shared();
+
+    std::vector<const BasicSSTable<Codec>*> tables;
+    for (auto& [_, sstable]: snapshot->sstables_) {
+        tables.push_back(&sstable);
+    }
+
+    std::atomic<size_t> next{0};
+    std::mutex corrupted_lock;
+    std::vector<size_t> corrupted;
+    auto worker = [&]() {
+        for (size_t i = next++; i < tables.size(); i = next++) {
+            try {
+                tables[i]->verify();
+            } catch (const std::exception& e) {
+                logging::log(e.what());
+                std::lock_guard<std::mutex> g{corrupted_lock};
+                corrupted.push_back(tables[i]->id());
+            }
+        }
+    };
+    {
+        size_t num_workers = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), tables.size());
+        std::vector<std::jthread> workers;
+        for (size_t i = 0; i < num_workers; i++) {
+            workers.emplace_back(worker);
+        }
+    }
+    std::sort(corrupted.begin(), corrupted.end());
+    return corrupted;
+}
+
+template<typename Codec>
+void BasicLSMKVStore<Codec>::account(const LSMStoreState<Codec>& state) {
+    size_t immutable_bytes = 0;
+    for (auto const& memtable: state.immutable_memtables_) {
+        immutable_bytes += memtable.size_;
+    }
+    size_t index_bytes = 0;
+    for (auto const& [_, sstable]: state.sstables_) {
+        index_bytes += sstable.index_bytes();
+    }
+    immutable_bytes_.store(immutable_bytes, std::memory_order_relaxed);
+    index_bytes_.store(index_bytes, std::memory_order_relaxed);
+}
+
+template<typename Codec>
+MemoryUsage BasicLSMKVStore<Codec>::memory_usage() {
+    snapshot_lock_.lock_shared();
+    size_t memtable = state_->memtable_.size_bytes();
+    snapshot_lock_.unlock_shared();
+    return MemoryUsage{
+        memtable,
+        immutable_bytes_.load(std::memory_order_relaxed),
+        index_bytes_.load(std::memory_order_relaxed),
+        row_cache_ ? row_cache_->size_bytes() : 0,
+    };
+}
+
+template<typename Codec>
+void BasicLSMKVStore<Codec>::shrink_caches(size_t target_bytes) {
+    if (row_cache_) {
+        row_cache_->shrink(target_bytes);
+    }
+}
+
+template<typename Codec>
+std::future<std::vector<size_t>> BasicLSMKVStore<Codec>::scrub() {
+    auto promise = std::make_shared<std::promise<std::vector<size_t>>>();
+    auto result = promise->get_future();
+    scheduler_.schedule(JobPriority::Low, [this, promise] {
+        try {
+            promise->set_value(verify_all());
+        } catch (...) {
+            promise->set_exception(std::current_exception());
+        }
+    });
+    return result;
+}
+
+template<typename Codec>
+size_t BasicLSMKVStore<Codec>::catch_up() {
+    if (!config_.read_only_) {
+        throw std::logic_error("catch_up is only valid on a read-only store");
+    }
+
+    // serializes concurrent catch ups, a secondary has no other writers
+    state_lock_.lock();
+
+    snapshot_lock_.lock_shared();
+    auto state = *state_;
+    snapshot_lock_.unlock_shared();
+
+    // the primary publishes tables by renaming finished files into place, and never removes them,
+    // so any table id not loaded yet is complete and newer data to add
+    size_t added = 0;
+    try {
+        for (auto const& entry: std::filesystem::directory_iterator(config_.directory_)) {
+            auto path = entry.path();
+            if (!BasicSSTable<Codec>::is_table_file(path)) {
+                continue;
+            }
+            // tables are named after their id, so loaded ones are skipped without opening them
+            auto named_id = BasicSSTable<Codec>::table_id(path);
+            if (named_id.has_value() && state.sstables_.contains(named_id.value())) {
+                continue;
+            }
+            BasicSSTable<Codec> table = BasicSSTable<Codec>::from_file(path);
+            size_t id = table.id();
+            if (state.sstables_.contains(id)) {
+                continue;
+            }
+            state.sstables_[id] = std::move(table);
+            added++;
+        }
+    } catch (...) {
+        state_lock_.unlock();
+        throw;
+    }
+
+    if (added > 0) {
+        snapshot_lock_.lock();
+        state_ = std::make_shared<LSMStoreState<Codec>>(std::move(state));
+        account(*state_);
+        snapshot_lock_.unlock();
+
+        if (row_cache_) {
+            row_cache_->clear();
+        }
+    }
+
+    state_lock_.unlock();
+    return added;
+}
+
+template<typename Codec>
+void BasicLSMKVStore<Codec>::follow_primary(std::stop_token stop) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        logging::log(std::format("inotify_init1 failed: {0}", std::strerror(errno)));
+        return;
+    }
+    // tables appear either by rename (flushes, ingest) or by a plain write
+    if (inotify_add_watch(fd, config_.directory_.c_str(), IN_MOVED_TO | IN_CLOSE_WRITE) < 0) {
+        logging::log(std::format("inotify_add_watch failed: {0}", std::strerror(errno)));
+        close(fd);
+        return;
+    }
+    auto load_tables = [this] {
+        try {
+            catch_up();
+        } catch (const std::exception& e) {
+            logging::log(std::format("catch_up failed: {0}", e.what()));
+        }
+    };
+    // tables published since open_dir but before the watch existed raised no event
+    load_tables();
+
+    // the poll timeout bounds how long stopping the watcher takes
+    alignas(inotify_event) char buf[4096];
+    while (!stop.stop_requested()) {
+        pollfd pfd{fd, POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+        bool published = false;
+        ssize_t len;
+        while ((len = read(fd, buf, sizeof(buf))) > 0) {
+            for (char *p = buf; p < buf + len; ) {
+                auto *event = reinterpret_cast<inotify_event*>(p);
+                // an overflowed queue dropped events, any of which may have been a table
+                if ((event->mask & IN_Q_OVERFLOW) ||
+                    (event->len > 0 && BasicSSTable<Codec>::is_table_file(event->name))) {
+                    published = true;
+                }
+                p += sizeof(inotify_event) + event->len;
+            }
+        }
+        if (published) {
+            load_tables();
+        }
+    }
+    close(fd);
+}
+
+template<typename Codec>
+BasicLSMKVStore<Codec>::~BasicLSMKVStore() {
+    // stop the watcher before anything it uses is torn down
+    if (watcher_.joinable()) {
+        watcher_.request_stop();
+        watcher_.join();
+    }
+    if (config_.memory_budget_) {
+        config_.memory_budget_->detach(this);
+    }
+    // runs every pending flush before the last memtable is written
+    scheduler_.shutdown();
+    if (config_.read_only_) {
+        return;
+    }
+    // memtables a failed flush left queued go out with the last one
+    auto last = state_->memtable_.freeze();
+    std::vector<const MemTable<Immutable, Codec>*> memtables;
+    for (auto const& memtable: state_->immutable_memtables_) {
+        memtables.push_back(&memtable);
+    }
+    if (last.size_ > 0) {
+        memtables.push_back(&last);
+    }
+    if (memtables.empty()) {
+        return;
+    }
+    try {
+        auto older_value = [&](const Key& k) { return read_tables(*state_, k, {}); };
+        auto _ = BasicSSTable<Codec>::from_memtables(state_->next_table_id(), config_.directory_, memtables,
+                                                     config_.merge_operator_, config_.block_size_, nullptr, older_value);
+    } catch (const std::exception& e) {
+        logging::log(std::format("Final flush failed, unflushed writes are lost: {0}", e.what()));
     }
 }
+
+template class BasicLSMKVStore<StringKey>;
+template class BasicLSMKVStore<U64Key>;
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+struct RowCacheStats {
+    size_t hits;
+    size_t misses;
+    size_t inserts;
+    size_t evictions;
+    size_t size_bytes;
+    // lowered for good by a memory budget, see RowCache::shrink
+    size_t capacity_bytes;
+
+    double hit_rate() const { return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / (hits + misses); }
+};
+
+// LRU cache of user key -> live value, bounded by key + value bytes
+// writers invalidate entries; a fill is dropped if its shard saw a write since the lookup began,
+// so a slow reader can never reinstate a value that was overwritten while it was searching
+class RowCache {
+public:
+    RowCache(size_t capacity_bytes);
+
+    // on a miss, generation is set to the value a later insert for this key must present
+    std::optional<std::string> get(const std::string& key, size_t& generation);
+    void insert(const std::string& key, const std::string& value, size_t generation);
+    void invalidate(const std::string& key);
+    void clear();
+    // caps the capacity at target_bytes from now on, evicting least recently used rows to fit
+    void shrink(size_t target_bytes);
+    size_t size_bytes() const { return size_bytes_.load(std::memory_order_relaxed); }
+
+    RowCacheStats stats() const;
+
+private:
+    static constexpr size_t NUM_SHARDS = 16;
+
+    struct Shard {
+        mutable std::mutex m_;
+        std::list<std::pair<std::string, std::string>> lru_;
+        std::unordered_map<std::string, std::list<std::pair<std::string, std::string>>::iterator> index_;
+        size_t size_ = 0;
+        size_t generation_ = 0;
+    };
+
+    Shard& shard(const std::string& key);
+    void evict(Shard& shard, size_t capacity);
+
+    std::atomic<size_t> shard_capacity_;
+    std::array<Shard, NUM_SHARDS> shards_;
+    std::atomic<size_t> hits_{0};
+    std::atomic<size_t> misses_{0};
+    std::atomic<size_t> inserts_{0};
+    std::atomic<size_t> evictions_{0};
+    std::atomic<size_t> size_bytes_{0};
+};
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace checksum {
+    // CRC32C (Castagnoli), using SSE4.2 or ARMv8 CRC instructions when available
+    uint32_t crc32c(std::span<const std::byte> data);
+    // true if crc32c runs on hardware instructions
+    bool hardware_accelerated();
+}
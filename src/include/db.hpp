@@ -1,3 +1,6 @@
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <queue>
 #include <shared_mutex>
 #include <string>
@@ -6,19 +9,41 @@
 #include <variant>
 #include <vector>
 #include <filesystem>
-#include "utils.hpp"
+#include <future>
+
+#include "cache.hpp"
+#include "key.hpp"
+#include "memory.hpp"
+#include "scheduler.hpp"
 
 #include "memtable.hpp"
 #include "sstable.hpp"
 
-enum FlushMessage {
-    Flush, 
-    Stop
-};
-
 struct KVStoreConfig {
     size_t memtable_threshold_;
     std::filesystem::path directory_;
+    // bytes of key + value kept in the row cache, 0 disables it
+    size_t row_cache_bytes_ = 0;
+    // resolves operands written by LSMKVStore::merge, required to call merge
+    MergeOperator merge_operator_;
+    ChecksumVerification checksum_verification_ = ChecksumVerification::Always;
+    // data block size of newly written SSTables, MIN_BLOCK_SIZE to MAX_BLOCK_SIZE;
+    // existing tables keep the size they were written with
+    size_t block_size_ = BLOCK_SIZE;
+    // optional limit shared with other stores, see MemoryBudget
+    std::shared_ptr<MemoryBudget> memory_budget_;
+    // threads running flushes and maintenance jobs
+    size_t background_threads_ = 2;
+    // caps the write rate of background flushes, 0 means unlimited
+    size_t background_write_bytes_per_sec_ = 0;
+    // a flush writes every queued immutable memtable into one SSTable, up to this many bytes
+    // (at least one memtable is always taken), 0 means no limit
+    size_t flush_coalesce_bytes_ = 0;
+    // opens the directory as a secondary of a primary store writing to it; writes throw std::logic_error
+    // and only flushed data is visible, see LSMKVStore::catch_up
+    bool read_only_ = false;
+    // read-only only: watch the directory and catch up whenever the primary publishes a table
+    bool follow_primary_ = false;
 
     KVStoreConfig() = delete;
     KVStoreConfig(size_t memtable_threshold, std::filesystem::path directory): memtable_threshold_(memtable_threshold), directory_(directory) {
@@ -26,34 +51,89 @@ struct KVStoreConfig {
     }
 };
 
+template<typename Codec>
 struct LSMStoreState {
     public:
         LSMStoreState(): memtable_(0), next_table_id_{1} {};
         static LSMStoreState open_dir(std::filesystem::path directory);
         size_t next_table_id() {return next_table_id_++; };
-        MemTable<Mutable> memtable_;
-        std::deque<MemTable<Immutable>> immutable_memtables_;
-        std::map<size_t, SSTable> sstables_;
+        MemTable<Mutable, Codec> memtable_;
+        std::deque<MemTable<Immutable, Codec>> immutable_memtables_;
+        std::map<size_t, BasicSSTable<Codec>> sstables_;
     private:
         size_t next_table_id_;
 };
 
-class LSMKVStore {
+// Codec picks the key type at compile time, see key.hpp; use LSMKVStore for string keys
+// and U64KVStore for fixed width integer keys
+template<typename Codec = StringKey>
+class BasicLSMKVStore : public BudgetedStore {
     public:
-        LSMKVStore(const KVStoreConfig& config);
-        std::optional<std::string> get(std::string k);
-        void put(std::string k, std::string v);
-        void remove(std::string k);
-        ~LSMKVStore();
+        using Key = typename Codec::Key;
+
+        BasicLSMKVStore(const KVStoreConfig& config);
+        std::optional<std::string> get(Key k);
+        void put(Key k, std::string v);
+        void remove(Key k);
+        // records operand for key without reading; get applies the merge operator lazily
+        void merge(Key k, std::string operand);
+        // deletes every key in [begin, end) with a single range tombstone
+        void remove_range(Key begin, Key end);
+        // atomically adds SSTables built with a BasicSSTableWriter of the same Codec; they are newer than all existing data,
+        // and later paths are newer than earlier ones. The files are moved into the store's directory;
+        // if ingest throws, none of them is added and each is moved back, though memtables may have been flushed
+        void ingest(const std::vector<std::filesystem::path>& paths);
+        // nullopt if the row cache is disabled
+        std::optional<RowCacheStats> row_cache_stats() const;
+        // checks every checksum of every SSTable in parallel, returns the ids of corrupted tables
+        std::vector<size_t> verify_all();
+        // runs verify_all as a low priority background job
+        std::future<std::vector<size_t>> scrub();
+        MemoryUsage memory_usage() override;
+        // read-only only: loads tables the primary has flushed since the last call, returns how many
+        size_t catch_up();
+        ~BasicLSMKVStore();
     private:
+        // applies f to the active memtable, then freezes it if it grew past the threshold
+        template<typename F>
+        void write(F&& f);
+        // looks k up in state's SSTables, operands are the ones already found in newer levels
+        std::optional<std::string> read_tables(LSMStoreState<Codec>& state, const Key& k, std::vector<std::string> operands);
+        // applies the merge operator to operands on top of base; tombstones and empty results read as nullopt
+        std::optional<std::string> resolve(const Key& k, std::optional<std::string> base,
+                                           const std::vector<std::string>& operands) const;
+        void freeze_memtable(size_t min_bytes) override;
+        // records the memory held by a newly published state
+        void account(const LSMStoreState<Codec>& state);
+        void shrink_caches(size_t target_bytes) override;
+        // also throws std::runtime_error once a background flush has failed
+        void check_writable();
+        // makes every later write fail with error, the first failure wins
+        void fail_flushes(const std::string& error);
+        bool flush_failed() override;
+        // calls catch_up whenever a table appears in the directory, until stopped
+        void follow_primary(std::stop_token stop);
+
         std::string directory_;
         KVStoreConfig config_;
-        Channel<FlushMessage> flush_channel_;
-        std::jthread flush_thead_;
+        BackgroundScheduler scheduler_;
+        std::unique_ptr<RateLimiter> rate_limiter_;
         std::shared_mutex snapshot_lock_;
         std::shared_mutex state_lock_;
-        std::shared_ptr<LSMStoreState> state_;
+        // serializes flushes and ingest, taken before state_lock_
+        std::mutex flush_lock_;
+        std::shared_ptr<LSMStoreState<Codec>> state_;
+        std::unique_ptr<RowCache> row_cache_;
+        std::atomic<size_t> immutable_bytes_{0};
+        std::atomic<size_t> index_bytes_{0};
+        std::atomic<bool> flush_failed_{false};
+        std::mutex flush_error_lock_;
+        std::string flush_error_;
+        std::jthread watcher_;
     
-    friend void flush_thread_func(LSMKVStore& store);
+    template<typename C>
+    friend void flush_job(BasicLSMKVStore<C>& store);
 };
 
+using LSMKVStore = BasicLSMKVStore<>;
+using U64KVStore = BasicLSMKVStore<U64Key>;
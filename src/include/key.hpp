@@ -0,0 +1,48 @@
+#pragma once
+
+#include <bit>
+#include <compare>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// a key codec fixes how a store holds its keys in memory
+// on disk every key is written as encode(key), and encoded keys sort in the same order as the keys,
+// so SSTables, range tombstones and the row cache work on encoded keys regardless of the codec
+
+// arbitrary byte string keys, the default
+struct StringKey {
+    using Key = std::string;
+
+    static const std::string& encode(const Key& key) { return key; }
+    static Key decode(std::string_view raw) { return Key(raw); }
+    // bytes the key takes in an entry
+    static size_t size(const Key& key) { return key.size(); }
+    static std::strong_ordering compare(std::string_view raw, const Key& key) { return raw <=> std::string_view(key); }
+};
+
+// fixed width integer keys, held inline and compared as integers
+// encoded big-endian so byte order matches numeric order
+struct U64Key {
+    using Key = uint64_t;
+    static constexpr size_t WIDTH = sizeof(uint64_t);
+
+    // fits in the small string buffer, so encoding never allocates
+    static std::string encode(Key key) {
+        if constexpr (std::endian::native == std::endian::little) key = std::byteswap(key);
+        return std::string(reinterpret_cast<const char *>(&key), WIDTH);
+    }
+    static Key decode(std::string_view raw) {
+        if (raw.size() != WIDTH) {
+            throw std::invalid_argument("U64Key expects 8 byte keys");
+        }
+        Key key;
+        std::memcpy(&key, raw.data(), WIDTH);
+        if constexpr (std::endian::native == std::endian::little) key = std::byteswap(key);
+        return key;
+    }
+    static size_t size(Key) { return WIDTH; }
+    static std::strong_ordering compare(std::string_view raw, Key key) { return decode(raw) <=> key; }
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+template<typename Codec>
+class BasicLSMKVStore;
+template<typename Codec>
+void flush_job(BasicLSMKVStore<Codec>& store);
+
+// bytes held in memory by one store, or by every store sharing a budget
+struct MemoryUsage {
+    size_t memtable;
+    size_t immutable_memtables;
+    size_t indexes; // resident Metadata and range tombstones of open SSTables
+    size_t caches;
+
+    size_t total() const { return memtable + immutable_memtables + indexes + caches; }
+};
+
+// what a MemoryBudget needs from the stores it manages, whatever their key codec
+class BudgetedStore {
+public:
+    virtual MemoryUsage memory_usage() = 0;
+protected:
+    ~BudgetedStore() = default;
+private:
+    friend class MemoryBudget;
+    virtual void shrink_caches(size_t target_bytes) = 0;
+    // moves the active memtable to the flush queue if it holds more than min_bytes
+    virtual void freeze_memtable(size_t min_bytes) = 0;
+    // true once the store's flushes stopped, its immutable memtables will not be released
+    virtual bool flush_failed() = 0;
+
+    // the store's share of MemoryBudget's running total
+    std::atomic<size_t> reported_bytes_{0};
+};
+
+// a memory limit shared by any number of stores (set KVStoreConfig::memory_budget_)
+// when a write takes the total past the limit, caches are capped first, then the largest
+// active memtable is frozen for an early flush, and finally the writer waits for pending flushes
+// of stores whose flushes have not failed
+// the total is kept as a running sum of what each store last reported, so writes under the
+// limit only look at their own store and take no lock
+class MemoryBudget {
+public:
+    MemoryBudget(size_t limit_bytes): limit_{limit_bytes} {}
+    MemoryBudget(const MemoryBudget&) = delete;
+    MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+    size_t limit() const { return limit_; }
+    MemoryUsage usage();
+
+private:
+    template<typename Codec>
+    friend class BasicLSMKVStore;
+    template<typename Codec>
+    friend void flush_job(BasicLSMKVStore<Codec>& store);
+
+    void attach(BudgetedStore* store);
+    void detach(BudgetedStore* store);
+    // called by a store after it grew, without any store lock held
+    void enforce(BudgetedStore* store);
+    // called by a store after a flush released memory
+    void released();
+
+    // updates the store's share of total_ with its current usage
+    MemoryUsage report(BudgetedStore* store);
+    // sums fresh reports of every store, stores_lock_ must be held
+    MemoryUsage usage_locked();
+
+    size_t limit_;
+    std::atomic<size_t> total_{0};
+    // held shared while calling into stores, so a store cannot detach and go away meanwhile
+    std::shared_mutex stores_lock_;
+    std::vector<BudgetedStore*> stores_;
+    // only for waiting on flushes, never held while calling into a store
+    std::mutex m_;
+    std::condition_variable released_;
+    size_t releases_ = 0;
+};
@@ -1,22 +1,66 @@
 #pragma once
 
+#include <functional>
 #include <map>
 #include <optional>
 #include <shared_mutex>
+#include <span>
 #include <string>
+#include <vector>
+#include "key.hpp"
 
 enum MemTableType {
     Mutable, 
     Immutable
 };
 
-template<MemTableType t>
+// combines the base value (nullopt if the key is absent or deleted) with merge operands, oldest first
+// key is in its encoded form, see key.hpp; an empty result deletes the key
+// a flush may apply a key's operands in several steps, so applying a then b must equal applying a + b
+using MergeOperator = std::function<std::string(const std::string& key, const std::optional<std::string>& base,
+                                                const std::vector<std::string>& operands)>;
+
+// what one memtable or SSTable holds for a key
+struct Entry {
+    // plain value, "" is a tombstone; nullopt if only merge operands are stored and the base is older
+    std::optional<std::string> value;
+    // operands to apply on top of value, oldest first
+    std::vector<std::string> operands;
+};
+
+// merge operands a memtable holds for one key, oldest first
+struct Operands {
+    std::vector<std::string> list;
+    // size of the list encoded as an SSTable record, kept up to date as operands arrive
+    size_t encoded_bytes = 0;
+};
+
+// set of deleted half-open key ranges [begin, end), kept merged so lookups are a single search
+// a range tombstone only hides data in older tables; point entries stored next to it are newer
+class RangeTombstones {
+public:
+    static RangeTombstones from_raw(std::span<std::byte> raw);
+    std::vector<std::byte> to_raw() const;
+
+    void add(const std::string& begin, const std::string& end);
+    bool covers(const std::string& key) const;
+    bool empty() const { return ranges_.empty(); }
+    size_t size_bytes() const;
+    const std::map<std::string, std::string>& ranges() const { return ranges_; }
+private:
+    // begin -> end, non-overlapping
+    std::map<std::string, std::string> ranges_;
+};
+
+template<MemTableType t, typename Codec = StringKey>
 class MemTable;
 
-template<>
-class MemTable<Mutable> {
+template<typename Codec>
+class MemTable<Mutable, Codec> {
     // these methods are NOT thread-safe (to allow MemTable to be copied/moved)
 public:
+    using Key = typename Codec::Key;
+
     MemTable(const MemTable& other); // this is made explicit because it involves taking the lock
 
     // Moves are NOT thread safe on the object being moved from
@@ -27,28 +71,40 @@ public:
 
     size_t id() { return id_; };
 
-    std::optional<std::string> get(const std::string& k);
-    void put(const std::string& k, const std::string& v);
+    // a key covered by a range tombstone reads as a tombstone (empty value)
+    std::optional<Entry> get(const Key& k);
+    void put(const Key& k, const std::string& v);
+    void merge(const Key& k, const std::string& operand);
+    void remove_range(const Key& begin, const Key& end);
     size_t size_bytes() { return size_; };
 
-    MemTable<Immutable> freeze();
+    MemTable<Immutable, Codec> freeze();
 private:
     size_t id_;
     mutable std::shared_mutex lock_;
-    std::map<std::string, std::string> memtable_;
+    std::map<Key, std::string> memtable_;
+    // operands newer than the memtable_ entry for the same key
+    std::map<Key, Operands> merges_;
+    // holds encoded keys
+    RangeTombstones range_tombstones_;
     size_t size_;
 };
 
 // this is just a record type
-template<>
-class MemTable<Immutable> {
+template<typename Codec>
+class MemTable<Immutable, Codec> {
 public:
-    MemTable(size_t id, std::map<std::string, std::string> memtable, size_t size);
+    using Key = typename Codec::Key;
+
+    MemTable(size_t id, std::map<Key, std::string> memtable, std::map<Key, Operands> merges,
+             RangeTombstones range_tombstones, size_t size);
     size_t id() { return id_; };
-    std::optional<std::string> get(const std::string& k);
+    std::optional<Entry> get(const Key& k);
     size_t size_bytes() { return size_; };
 
     size_t id_;
-    std::map<std::string, std::string> memtable_;
+    std::map<Key, std::string> memtable_;
+    std::map<Key, Operands> merges_;
+    RangeTombstones range_tombstones_;
     size_t size_;
 };
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+enum class JobPriority {
+    Low,  // maintenance, e.g. scrubbing; dropped if still queued at shutdown
+    High, // flushes; always run before shutdown completes
+};
+
+// limits background I/O to a byte rate so it cannot starve foreground reads
+class RateLimiter {
+public:
+    RateLimiter(size_t bytes_per_sec): bytes_per_sec_{bytes_per_sec} {}
+    // blocks until bytes may be written
+    void request(size_t bytes);
+private:
+    size_t bytes_per_sec_;
+    std::mutex m_;
+    // the point in time by which all bytes granted so far are paid for
+    std::chrono::steady_clock::time_point next_free_{};
+};
+
+// fixed pool of background threads; higher priority jobs run first, FIFO within a priority
+// exceptions escaping a job are logged and dropped, jobs report their own failures
+class BackgroundScheduler {
+public:
+    BackgroundScheduler(size_t num_threads);
+    BackgroundScheduler(const BackgroundScheduler&) = delete;
+    BackgroundScheduler& operator=(const BackgroundScheduler&) = delete;
+
+    void schedule(JobPriority priority, std::function<void()> job);
+    // runs every queued High job, drops queued Low jobs, and joins the threads
+    void shutdown();
+    ~BackgroundScheduler();
+
+private:
+    struct Job {
+        JobPriority priority;
+        size_t seq;
+        std::function<void()> run;
+
+        bool operator<(const Job& other) const {
+            if (priority != other.priority) return priority < other.priority;
+            return seq > other.seq;
+        }
+    };
+
+    void worker();
+
+    std::mutex m_;
+    std::condition_variable nonempty_;
+    std::priority_queue<Job> queue_;
+    size_t next_seq_ = 0;
+    bool stopping_ = false;
+    std::vector<std::jthread> threads_;
+};
@@ -1,108 +1,276 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <fstream>
 #include <filesystem>
+#include <functional>
+#include <memory>
 #include <optional>
 #include <span>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
+#include "key.hpp"
 #include "memtable.hpp"
+#include "scheduler.hpp"
 
-const size_t BLOCK_SIZE = 4096; // block size = page size
+const size_t BLOCK_SIZE = 4096; // default block size = page size, see KVStoreConfig::block_size_
+const size_t MIN_BLOCK_SIZE = 256;
+const uint32_t FORMAT_VERSION = 1;
+const size_t BLOCK_TRAILER_SIZE = sizeof(uint32_t); // crc32c of the rest of the block
+const uint32_t MERGE_FLAG = 1u << 31; // marks a merge operand record in valuelen
+const size_t MAX_BLOCK_SIZE = MERGE_FLAG - 1; // keeps every valuelen clear of MERGE_FLAG
+
+// largest value, or encoded operand list, a data block can hold next to a key of key_size bytes
+constexpr size_t max_value_size(size_t block_size, size_t key_size) {
+    size_t overhead = BLOCK_TRAILER_SIZE + 2 * sizeof(uint32_t) + key_size;
+    return block_size > overhead ? block_size - overhead : 0;
+}
 
 // file format
 // [B0, B1, B2, B3, ..., B_{N - 1}]
-// block size = 1 page (4KB)
+// block size is chosen per table and recorded in the file index (4KB by default)
 // key len, value len are 4B
+// keys are stored encoded by the store's key codec (see key.hpp), 8 bytes each for U64Key
 
 // data block format
-// keylen (4 bytes) key valuelen (4 bytes) value
+// keylen (4 bytes) key valuelen (4 bytes) value ... padding, crc32c (4 bytes)
+// if the top bit of valuelen is set, value is a list of merge operands, oldest first:
+// operandlen (4 bytes) operand operandlen (4 bytes) operand ...
 
 // metadata format (flat, after data blocks)
 // keylen (4 bytes) key keylen (4 bytes) key
 // one entry per data block: the first key stored in that block
 
+// range tombstone format (flat, after metadata)
+// beginlen (4 bytes) begin endlen (4 bytes) end
+// point entries in the same table are newer than its range tombstones
+
 // file index format (at end of file)
-// block size (2 bytes), num blocks (4 bytes), id (8 bytes)
+// block size (4 bytes), num blocks (4 bytes), range tombstones size (4 bytes),
+// metadata crc32c (4 bytes), range tombstones crc32c (4 bytes), id (8 bytes),
+// format version (4 bytes), file index crc32c (4 bytes)
+// the version sits at a fixed distance from the end so readers can check it before parsing the rest
+
+// thrown when a checksum does not match or a section is malformed
+class CorruptionError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// when data blocks are checked against their checksums
+// the file index, metadata and range tombstones are always verified when a table is opened
+enum class ChecksumVerification {
+    Always,      // every block read
+    OnFirstLoad, // the first read of each block in this process
+    Scrub        // only by SSTable::verify / LSMKVStore::verify_all
+};
 
+// read-only memory mapping of an immutable file, copies share the mapping
+// reads are positionless, so one File can serve concurrent readers
 class File {
 public:
     static File create(std::filesystem::path, const std::span<std::byte> data);
     static File open(std::filesystem::path path);
 
-    void read(std::span<std::byte> buf, size_t offset, size_t len);
+    void read(std::span<std::byte> buf, size_t offset, size_t len) const;
     size_t size() const;
+    const std::filesystem::path& path() const { return path_; }
 
     File() = default;
-    File(const File&);
-    File& operator=(const File);
-    File(File&&);
 
 private:
+    struct Mapping {
+        void *data_ = nullptr;
+        size_t size_ = 0;
+        Mapping() = default;
+        Mapping(const Mapping&) = delete;
+        Mapping& operator=(const Mapping&) = delete;
+        ~Mapping();
+    };
+
     std::filesystem::path path_;
-    std::ifstream f_;
+    std::shared_ptr<Mapping> mapping_;
 };
 
 // represents a disk block loaded into memory
-class Block {
+template<typename Codec = StringKey>
+class BasicBlock {
 public:
-    static Block from_raw(std::span<std::byte> raw);
-    std::optional<std::string> get(const std::string& key) const;
+    using Key = typename Codec::Key;
+
+    // raw includes the checksum trailer
+    static BasicBlock from_raw(std::span<std::byte> raw);
+    static BasicBlock from_raw(std::vector<std::byte>&& raw);
+    // throws CorruptionError if the trailer does not match the block contents
+    static void verify(std::span<const std::byte> raw);
+    // compares stored keys against key without copying them out of the block
+    // get and for_each throw CorruptionError on a key that does not have the codec's fixed width
+    std::optional<Entry> get(const Key& key) const;
+    // visits entries in key order until f returns false, keys are encoded
+    void for_each(const std::function<bool(std::string_view key, const Entry& entry)>& f) const;
 private:
     std::vector<std::byte> data_;
     std::vector<uint32_t> offsets_;
 };
 
-class BlockBuilder {
+template<typename Codec = StringKey>
+class BasicBlockBuilder {
 public:
+    using Key = typename Codec::Key;
+
+    BasicBlockBuilder(size_t block_size = BLOCK_SIZE): block_size_{block_size} {}
     // Returns false if the entry does not fit (block is full).
-    bool push(const std::string& key, const std::string& value);
+    // Throws std::invalid_argument if it would not fit even an empty block.
+    // merge marks value as an encoded operand list
+    bool push(const Key& key, const std::string& value, bool merge = false);
     std::vector<std::byte> build();
     bool empty() const { return data_.empty(); }
+    size_t block_size() const { return block_size_; }
 private:
+    size_t block_size_;
     std::vector<std::byte> data_;
 };
 
 // sparse index: stores the first key of each data block
-class Metadata {
+// decoded keys are kept, so for U64Key this is a flat integer array searched without branches
+template<typename Codec = StringKey>
+class BasicMetadata {
 public:
-    static Metadata from_raw(std::span<std::byte> raw);
+    using Key = typename Codec::Key;
+
+    static BasicMetadata from_raw(std::span<std::byte> raw);
     std::vector<std::byte> to_raw() const;
-    size_t lookup_block(const std::string& key) const;
-    void add_first_key(const std::string& key) { first_keys_.push_back(key); }
+    size_t lookup_block(const Key& key) const;
+    void add_first_key(const Key& key) { first_keys_.push_back(key); }
     size_t num_blocks() const { return first_keys_.size(); }
+    size_t size_bytes() const;
 private:
-    std::vector<std::string> first_keys_;
+    std::vector<Key> first_keys_;
 };
 
+using Block = BasicBlock<>;
+using BlockBuilder = BasicBlockBuilder<>;
+using Metadata = BasicMetadata<>;
+
 struct FileIndex {
     static FileIndex from_raw(std::span<std::byte> raw);
     std::vector<std::byte> to_raw() const;
 
-    static constexpr size_t SIZE = sizeof(uint16_t) + sizeof(uint32_t) + sizeof(size_t);
+    static constexpr size_t SIZE = 5 * sizeof(uint32_t) + sizeof(size_t) + 2 * sizeof(uint32_t);
 
-    uint16_t block_size;
+    uint32_t block_size;
     uint32_t num_blocks;
+    uint32_t range_tombstones_size;
+    uint32_t metadata_crc;
+    uint32_t range_tombstones_crc;
     size_t id;
 };
 
-class SSTable {
+template<typename Codec>
+class BasicSSTableWriter;
+
+template<typename Codec = StringKey>
+class BasicSSTable {
+    friend class BasicSSTableWriter<Codec>;
 public:
-    std::optional<std::string> get(std::string k);
+    using Key = typename Codec::Key;
+
+    std::optional<Entry> get(const Key& k, ChecksumVerification verification = ChecksumVerification::Always);
     size_t id() const { return id_; }
-    static SSTable from_memtable(size_t id, std::filesystem::path directory, const MemTable<Immutable>& memtable);
-    static SSTable from_file(std::filesystem::path filepath);
+    const std::filesystem::path& path() const { return file_.path(); }
+    size_t block_size() const { return file_index_.block_size; }
+    // memory held by the resident metadata and range tombstones
+    size_t index_bytes() const { return metadata_.size_bytes() + range_tombstones_.size_bytes(); }
+    // rereads the whole file and checks every checksum, throws CorruptionError
+    void verify() const;
+    // visits every entry in key order, reading blocks sequentially, keys are encoded
+    void scan(const std::function<void(std::string_view key, const Entry& entry)>& f) const;
+    // operands whose base value is in the same memtable are collapsed with merge_operator
+    static BasicSSTable from_memtable(size_t id, std::filesystem::path directory, const MemTable<Immutable, Codec>& memtable,
+                                      const MergeOperator& merge_operator = {}, size_t block_size = BLOCK_SIZE,
+                                      RateLimiter* rate_limiter = nullptr);
+    // what the tables older than a flush hold for a key, with their merge operands applied
+    using OlderValue = std::function<std::optional<std::string>(const Key& key)>;
+    // writes several memtables, oldest first, as one table where newer memtables win
+    // operand lists that do not fit in a block are resolved against older_value, or fail the table without it
+    static BasicSSTable from_memtables(size_t id, std::filesystem::path directory,
+                                       const std::vector<const MemTable<Immutable, Codec>*>& memtables,
+                                       const MergeOperator& merge_operator = {}, size_t block_size = BLOCK_SIZE,
+                                       RateLimiter* rate_limiter = nullptr, const OlderValue& older_value = {});
+    static BasicSSTable from_file(std::filesystem::path filepath);
+    // true for names tables are published under, false for partially written ones
+    static bool is_table_file(const std::filesystem::path& path);
+    // the id a table file is named after, without opening it; nullopt if the name does not follow the pattern
+    static std::optional<size_t> table_id(const std::filesystem::path& path);
+    // moving an externally built table into directory takes two steps: staging moves the file in under a name
+    // readers ignore and rewrites its id, publishing renames it into place; unstaging puts a staged or published file back
+    static std::filesystem::path stage_external_file(std::filesystem::path filepath, std::filesystem::path directory,
+                                                     size_t id);
+    static BasicSSTable publish_external_file(const std::filesystem::path& staged);
+    static void unstage_external_file(const std::filesystem::path& staged, const std::filesystem::path& filepath) noexcept;
 
-    SSTable() = default;
-    SSTable(const SSTable&) = default;
-    SSTable& operator=(const SSTable&) = default;
-    SSTable(SSTable&&) = default;
-    SSTable& operator=(SSTable&&) = default;
+    BasicSSTable() = default;
+    BasicSSTable(const BasicSSTable&) = default;
+    BasicSSTable& operator=(const BasicSSTable&) = default;
+    BasicSSTable(BasicSSTable&&) = default;
+    BasicSSTable& operator=(BasicSSTable&&) = default;
 
 private:
     size_t id_ = 0;
     File file_;
     FileIndex file_index_{};
-    Metadata metadata_;
+    BasicMetadata<Codec> metadata_;
+    RangeTombstones range_tombstones_;
+    // one flag per data block for ChecksumVerification::OnFirstLoad, shared between copies
+    std::shared_ptr<std::vector<std::atomic<bool>>> verified_blocks_;
 };
+
+// streams sorted key-value pairs straight into an SSTable file, bypassing the memtable
+// used for flushes and for building tables offline (see LSMKVStore::ingest)
+// the file is written as <path>.tmp and only appears under path once finish succeeds
+template<typename Codec = StringKey>
+class BasicSSTableWriter {
+public:
+    using Key = typename Codec::Key;
+
+    // rate_limiter, if given, paces every write to the file
+    BasicSSTableWriter(std::filesystem::path path, size_t id = 0, size_t block_size = BLOCK_SIZE,
+                       RateLimiter* rate_limiter = nullptr);
+
+    // keys must be strictly increasing; an empty value is written as a tombstone
+    void add(const Key& key, const std::string& value);
+    // writes merge operands, oldest first, whose base value lives in older tables
+    void add_merge(const Key& key, const std::vector<std::string>& operands);
+    // deletes [begin, end) in older tables; may be called in any order relative to add
+    void add_range_tombstone(const Key& begin, const Key& end);
+    // writes the metadata and file index and returns the finished table
+    BasicSSTable<Codec> finish();
+
+    // removes the partially written file unless finish succeeded
+    ~BasicSSTableWriter();
+
+    BasicSSTableWriter(const BasicSSTableWriter&) = delete;
+    BasicSSTableWriter& operator=(const BasicSSTableWriter&) = delete;
+
+private:
+    void push(const Key& key, const std::string& value, bool merge);
+    void write_block();
+    void write(std::span<const std::byte> data);
+
+    std::filesystem::path path_;
+    size_t id_;
+    RateLimiter* rate_limiter_;
+    std::ofstream out_;
+    BasicBlockBuilder<Codec> builder_;
+    BasicMetadata<Codec> metadata_;
+    RangeTombstones range_tombstones_;
+    uint32_t num_blocks_ = 0;
+    std::optional<Key> last_key_;
+    bool finished_ = false;
+};
+
+using SSTable = BasicSSTable<>;
+using SSTableWriter = BasicSSTableWriter<>;
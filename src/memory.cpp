@@ -0,0 +1,110 @@
+#include "include/memory.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <chrono>
+#include <format>
+
+void MemoryBudget::attach(BudgetedStore* store) {
+    std::unique_lock<std::shared_mutex> g{stores_lock_};
+    stores_.push_back(store);
+    report(store);
+}
+
+void MemoryBudget::detach(BudgetedStore* store) {
+    std::unique_lock<std::shared_mutex> g{stores_lock_};
+    std::erase(stores_, store);
+    total_.fetch_sub(store->reported_bytes_.exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+MemoryUsage MemoryBudget::usage() {
+    std::shared_lock<std::shared_mutex> g{stores_lock_};
+    return usage_locked();
+}
+
+MemoryUsage MemoryBudget::report(BudgetedStore* store) {
+    auto usage = store->memory_usage();
+    size_t previous = store->reported_bytes_.exchange(usage.total(), std::memory_order_relaxed);
+    // unsigned wraparound makes this a subtraction when the store shrank
+    total_.fetch_add(usage.total() - previous, std::memory_order_relaxed);
+    return usage;
+}
+
+MemoryUsage MemoryBudget::usage_locked() {
+    MemoryUsage total{0, 0, 0, 0};
+    for (auto* store: stores_) {
+        auto usage = report(store);
+        total.memtable += usage.memtable;
+        total.immutable_memtables += usage.immutable_memtables;
+        total.indexes += usage.indexes;
+        total.caches += usage.caches;
+    }
+    return total;
+}
+
+void MemoryBudget::enforce(BudgetedStore* store) {
+    // fast path, other stores' reports may be stale until the slow path refreshes them all
+    report(store);
+    if (total_.load(std::memory_order_relaxed) <= limit_) {
+        return;
+    }
+
+    std::shared_lock<std::shared_mutex> stores{stores_lock_};
+    auto usage = usage_locked();
+    if (usage.total() <= limit_) {
+        return;
+    }
+    logging::log(std::format("Memory budget exceeded: {0} > {1}", usage.total(), limit_));
+
+    // caches are the cheapest to give back, cap them evenly
+    size_t excess = usage.total() - limit_;
+    if (usage.caches > 0) {
+        for (auto* store: stores_) {
+            size_t cache = store->memory_usage().caches;
+            size_t share = (excess * cache + usage.caches - 1) / usage.caches;
+            store->shrink_caches(cache - std::min(cache, share));
+        }
+        usage = usage_locked();
+        if (usage.total() <= limit_) {
+            return;
+        }
+    }
+
+    // turn the largest active memtable into a pending flush
+    auto largest = std::max_element(stores_.begin(), stores_.end(), [](BudgetedStore* a, BudgetedStore* b) {
+        return a->memory_usage().memtable < b->memory_usage().memtable;
+    });
+    if (largest != stores_.end() && (*largest)->memory_usage().memtable > 0) {
+        (*largest)->freeze_memtable(0);
+    }
+
+    // stall the writer while flushes can still bring usage down
+    while (true) {
+        size_t releases;
+        {
+            std::lock_guard<std::mutex> g{m_};
+            releases = releases_;
+        }
+        usage = usage_locked();
+        bool flushing = std::ranges::any_of(stores_, [](BudgetedStore* store) {
+            return !store->flush_failed() && store->memory_usage().immutable_memtables > 0;
+        });
+        if (usage.total() <= limit_ || !flushing) {
+            return;
+        }
+        // let stores detach while waiting
+        stores.unlock();
+        {
+            std::unique_lock<std::mutex> g{m_};
+            released_.wait_for(g, std::chrono::milliseconds(100), [&] { return releases_ != releases; });
+        }
+        stores.lock();
+    }
+}
+
+void MemoryBudget::released() {
+    {
+        std::lock_guard<std::mutex> g{m_};
+        releases_++;
+    }
+    released_.notify_all();
+}
@@ -1,57 +1,214 @@
 #include "include/memtable.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
 #include <mutex>
 #include <optional>
 #include <shared_mutex>
 
+// RangeTombstones implementations
+RangeTombstones RangeTombstones::from_raw(std::span<std::byte> raw) {
+    RangeTombstones r;
+    size_t offset = 0;
+    auto read_key = [&](std::string& out) {
+        if (offset + 4 > raw.size()) return false;
+        uint32_t key_len = *reinterpret_cast<const uint32_t *>(raw.data() + offset);
+        offset += 4;
+        if (offset + key_len > raw.size()) return false;
+        out.assign(reinterpret_cast<const char *>(raw.data() + offset), key_len);
+        offset += key_len;
+        return true;
+    };
+    std::string begin, end;
+    while (read_key(begin) && read_key(end)) {
+        r.ranges_[begin] = end;
+    }
+    return r;
+}
+
+std::vector<std::byte> RangeTombstones::to_raw() const {
+    std::vector<std::byte> result;
+    auto write_key = [&](const std::string& key) {
+        uint32_t key_len = static_cast<uint32_t>(key.size());
+        auto *p = reinterpret_cast<const std::byte *>(&key_len);
+        result.insert(result.end(), p, p + 4);
+        for (char c : key) result.push_back(static_cast<std::byte>(c));
+    };
+    for (const auto& [begin, end] : ranges_) {
+        write_key(begin);
+        write_key(end);
+    }
+    return result;
+}
+
+void RangeTombstones::add(const std::string& begin, const std::string& end) {
+    if (begin >= end) return;
+    std::string new_begin = begin;
+    std::string new_end = end;
+    // absorb every range that overlaps or touches [begin, end)
+    auto it = ranges_.upper_bound(begin);
+    if (it != ranges_.begin() && std::prev(it)->second >= begin) {
+        --it;
+    }
+    while (it != ranges_.end() && it->first <= new_end) {
+        new_begin = std::min(new_begin, it->first);
+        new_end = std::max(new_end, it->second);
+        it = ranges_.erase(it);
+    }
+    ranges_[new_begin] = new_end;
+}
+
+size_t RangeTombstones::size_bytes() const {
+    size_t size = 0;
+    for (const auto& [begin, end] : ranges_) {
+        size += begin.size() + end.size() + 2 * sizeof(std::string);
+    }
+    return size;
+}
+
+bool RangeTombstones::covers(const std::string& key) const {
+    auto it = ranges_.upper_bound(key);
+    if (it == ranges_.begin()) return false;
+    --it;
+    return key < it->second;
+}
+
 // MemTable<Mutable> implementations
-MemTable<Mutable>::MemTable(const MemTable& other): MemTable(other.id_) {
+template<typename Codec>
+MemTable<Mutable, Codec>::MemTable(const MemTable& other): MemTable(other.id_) {
     std::shared_lock<std::shared_mutex> g{other.lock_};
     this->memtable_ = other.memtable_;
+    this->merges_ = other.merges_;
+    this->range_tombstones_ = other.range_tombstones_;
     this->size_ = other.size_;
 }
 
-MemTable<Mutable>::MemTable(MemTable&& other): MemTable(other.id_) {
+template<typename Codec>
+MemTable<Mutable, Codec>::MemTable(MemTable&& other): MemTable(other.id_) {
     std::swap(this->memtable_, other.memtable_);
+    std::swap(this->merges_, other.merges_);
+    std::swap(this->range_tombstones_, other.range_tombstones_);
     std::swap(this->size_, other.size_);
 }
 
-MemTable<Mutable>& MemTable<Mutable>::operator=(MemTable other) {
+template<typename Codec>
+MemTable<Mutable, Codec>& MemTable<Mutable, Codec>::operator=(MemTable other) {
     std::swap(this->memtable_, other.memtable_);
+    std::swap(this->merges_, other.merges_);
+    std::swap(this->range_tombstones_, other.range_tombstones_);
     std::swap(this->size_, other.size_);
     std::swap(this->id_, other.id_);
     return *this;
 }
 
-std::optional<std::string> MemTable<Mutable>::get(const std::string& k) {
-    std::shared_lock<std::shared_mutex> g{lock_};
-    if (memtable_.contains(k)) {
-        return memtable_.at(k);
+// shared by both memtable types
+template<typename Codec>
+static std::optional<Entry> lookup(const std::map<typename Codec::Key, std::string>& memtable,
+                                   const std::map<typename Codec::Key, Operands>& merges,
+                                   const RangeTombstones& range_tombstones, const typename Codec::Key& k) {
+    Entry entry;
+    auto it = memtable.find(k);
+    if (it != memtable.end()) {
+        entry.value = it->second;
+    } else if (!range_tombstones.empty() && range_tombstones.covers(Codec::encode(k))) {
+        entry.value = std::string{};
+    }
+    auto merge_it = merges.find(k);
+    if (merge_it != merges.end()) {
+        entry.operands = merge_it->second.list;
     }
-    return std::nullopt;
+    if (!entry.value.has_value() && entry.operands.empty()) {
+        return std::nullopt;
+    }
+    return entry;
 }
 
-void MemTable<Mutable>::put(const std::string& k, const std::string& v) {
+template<typename Codec>
+std::optional<Entry> MemTable<Mutable, Codec>::get(const Key& k) {
+    std::shared_lock<std::shared_mutex> g{lock_};
+    return lookup<Codec>(memtable_, merges_, range_tombstones_, k);
+}
+
+template<typename Codec>
+void MemTable<Mutable, Codec>::put(const Key& k, const std::string& v) {
     std::unique_lock<std::shared_mutex> g{lock_};
     if (memtable_.contains(k)) {
         size_ = size_ + (v.size() - memtable_.at(k).size());
+    } else if (merges_.contains(k)) {
+        // key bytes are already counted by the operands
+        size_ = size_ + v.size();
     } else {
-        size_ = size_ + k.size() + v.size();
+        size_ = size_ + Codec::size(k) + v.size();
     }
     memtable_[k] = v;
+    // a plain value supersedes any pending operands
+    auto merge_it = merges_.find(k);
+    if (merge_it != merges_.end()) {
+        for (auto& operand: merge_it->second.list) {
+            size_ -= operand.size();
+        }
+        merges_.erase(merge_it);
+    }
+}
+
+template<typename Codec>
+void MemTable<Mutable, Codec>::merge(const Key& k, const std::string& operand) {
+    std::unique_lock<std::shared_mutex> g{lock_};
+    auto& operands = merges_[k];
+    if (operands.list.empty() && !memtable_.contains(k)) {
+        size_ += Codec::size(k);
+    }
+    operands.list.push_back(operand);
+    operands.encoded_bytes += sizeof(uint32_t) + operand.size();
+    size_ += operand.size();
 }
 
-MemTable<Immutable> MemTable<Mutable>::freeze() {
+template<typename Codec>
+void MemTable<Mutable, Codec>::remove_range(const Key& begin, const Key& end) {
+    std::unique_lock<std::shared_mutex> g{lock_};
+    if (begin >= end) return;
+    // entries already in this memtable are older than the tombstone, drop them
+    // operands first, a key that also has a value counts its bytes with the value
+    auto merge_first = merges_.lower_bound(begin);
+    auto merge_last = merges_.lower_bound(end);
+    for (auto it = merge_first; it != merge_last; ++it) {
+        if (!memtable_.contains(it->first)) {
+            size_ -= Codec::size(it->first);
+        }
+        for (auto& operand: it->second.list) {
+            size_ -= operand.size();
+        }
+    }
+    merges_.erase(merge_first, merge_last);
+    auto first = memtable_.lower_bound(begin);
+    auto last = memtable_.lower_bound(end);
+    for (auto it = first; it != last; ++it) {
+        size_ -= Codec::size(it->first) + it->second.size();
+    }
+    memtable_.erase(first, last);
+    range_tombstones_.add(Codec::encode(begin), Codec::encode(end));
+    size_ += Codec::size(begin) + Codec::size(end);
+}
+
+template<typename Codec>
+MemTable<Immutable, Codec> MemTable<Mutable, Codec>::freeze() {
     std::shared_lock<std::shared_mutex> g{lock_};
-    return MemTable<Immutable>(id_, memtable_, size_);
+    return MemTable<Immutable, Codec>(id_, memtable_, merges_, range_tombstones_, size_);
 }
 
 // MemTable<Immutable> implementations
-MemTable<Immutable>::MemTable(size_t id, std::map<std::string, std::string> memtable, size_t size)
-    : id_{id}, memtable_{std::move(memtable)}, size_{size} {}
+template<typename Codec>
+MemTable<Immutable, Codec>::MemTable(size_t id, std::map<Key, std::string> memtable,
+                                     std::map<Key, Operands> merges,
+                                     RangeTombstones range_tombstones, size_t size)
+    : id_{id}, memtable_{std::move(memtable)}, merges_{std::move(merges)}, range_tombstones_{std::move(range_tombstones)}, size_{size} {}
 
-std::optional<std::string> MemTable<Immutable>::get(const std::string& k) {
-    if (memtable_.contains(k)) {
-        return memtable_.at(k);
-    }
-    return std::nullopt;
+template<typename Codec>
+std::optional<Entry> MemTable<Immutable, Codec>::get(const Key& k) {
+    return lookup<Codec>(memtable_, merges_, range_tombstones_, k);
 }
+
+template class MemTable<Mutable, StringKey>;
+template class MemTable<Mutable, U64Key>;
+template class MemTable<Immutable, StringKey>;
+template class MemTable<Immutable, U64Key>;
@@ -0,0 +1,70 @@
+#include "include/scheduler.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <exception>
+#include <format>
+#include <stdexcept>
+
+void RateLimiter::request(size_t bytes) {
+    std::unique_lock<std::mutex> g{m_};
+    auto now = std::chrono::steady_clock::now();
+    // idle time is not banked, so bursts after a quiet period are still paced
+    next_free_ = std::max(next_free_, now);
+    auto wait_until = next_free_;
+    next_free_ += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(static_cast<double>(bytes) / bytes_per_sec_));
+    g.unlock();
+    std::this_thread::sleep_until(wait_until);
+}
+
+BackgroundScheduler::BackgroundScheduler(size_t num_threads) {
+    for (size_t i = 0; i < std::max<size_t>(num_threads, 1); i++) {
+        threads_.emplace_back([this] { worker(); });
+    }
+}
+
+void BackgroundScheduler::schedule(JobPriority priority, std::function<void()> job) {
+    std::lock_guard<std::mutex> g(m_);
+    if (stopping_) {
+        throw std::logic_error("BackgroundScheduler::schedule called after shutdown");
+    }
+    queue_.push(Job{priority, next_seq_++, std::move(job)});
+    nonempty_.notify_one();
+}
+
+void BackgroundScheduler::worker() {
+    while (true) {
+        std::unique_lock<std::mutex> g(m_);
+        nonempty_.wait(g, [&]() { return !queue_.empty() || stopping_; });
+        if (queue_.empty()) {
+            return;
+        }
+        Job job = queue_.top();
+        queue_.pop();
+        if (stopping_ && job.priority == JobPriority::Low) {
+            continue;
+        }
+        g.unlock();
+        // a failing job must not take the thread, or the process, down with it
+        try {
+            job.run();
+        } catch (const std::exception& e) {
+            logging::log(std::format("Background job failed: {0}", e.what()));
+        } catch (...) {
+            logging::log("Background job failed");
+        }
+    }
+}
+
+void BackgroundScheduler::shutdown() {
+    {
+        std::lock_guard<std::mutex> g(m_);
+        stopping_ = true;
+    }
+    nonempty_.notify_all();
+    threads_.clear();
+}
+
+BackgroundScheduler::~BackgroundScheduler() {
+    shutdown();
+}
@@ -1,5 +1,8 @@
 #include <algorithm>
 #include <assert.h>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
 #include <filesystem>
 #include <format>
 #include <fstream>
@@ -9,9 +12,14 @@
 #include <span>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "sstable.hpp"
 #include "memtable.hpp"
+#include "checksum.hpp"
 
 File File::create(std::filesystem::path path, const std::span<std::byte> data) {
   std::fstream write_stream;
@@ -24,90 +32,193 @@ File File::create(std::filesystem::path path, const std::span<std::byte> data) {
   return File::open(path);
 }
 
+File::Mapping::~Mapping() {
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+  }
+}
+
 File File::open(std::filesystem::path path) {
   File file;
   file.path_ = path;
-  file.f_.open(path, std::ios::in);
-  if (!file.f_.is_open()) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
     throw std::runtime_error("Failed to open file: " + path.string());
   }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw std::runtime_error("Failed to stat file: " + path.string());
+  }
+  file.mapping_ = std::make_shared<Mapping>();
+  file.mapping_->size_ = static_cast<size_t>(st.st_size);
+  if (file.mapping_->size_ > 0) {
+    // shared read-only mappings are backed by the page cache, so every process reading
+    // the same table shares one copy of it
+    void *data = mmap(nullptr, file.mapping_->size_, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      ::close(fd);
+      throw std::runtime_error("Failed to map file: " + path.string());
+    }
+    file.mapping_->data_ = data;
+  }
+  // the mapping stays valid after the descriptor is closed
+  ::close(fd);
   return file;
 }
 
-File::File(const File& other): path_{other.path_} {
-  f_.open(path_);
-  if (!f_.is_open()) {
-    throw std::runtime_error("Failed to open file: " + path_.string());
+size_t File::size() const {
+  return mapping_ ? mapping_->size_ : 0;
+}
+
+void File::read(std::span<std::byte> buf, size_t offset, size_t len) const {
+  if (!mapping_) {
+    throw std::runtime_error("File is not open");
   }
+  if (len > buf.size()) {
+    throw std::invalid_argument("Buffer too small for requested read length");
+  }
+  if (offset > mapping_->size_ || len > mapping_->size_ - offset) {
+    throw std::runtime_error("Read past the end of " + path_.string());
+  }
+  std::memcpy(buf.data(), static_cast<const std::byte *>(mapping_->data_) + offset, len);
 }
 
-File& File::operator=(File other) {
-  std::swap(this->path_, other.path_);
-  std::swap(this->f_, other.f_);
-  return *this;
+template<typename Codec>
+BasicBlock<Codec> BasicBlock<Codec>::from_raw(std::span<std::byte> raw) {
+  BasicBlock b;
+  b.data_.assign(raw.begin(), raw.end() - BLOCK_TRAILER_SIZE);
+  return b;
 }
 
-File::File(File&& other): File() {
-  std::swap(this->path_, other.path_);
-  std::swap(this->f_, other.f_);
+template<typename Codec>
+BasicBlock<Codec> BasicBlock<Codec>::from_raw(std::vector<std::byte>&& raw) {
+  BasicBlock b;
+  b.data_ = std::move(raw);
+  b.data_.resize(b.data_.size() - BLOCK_TRAILER_SIZE);
+  return b;
 }
 
-size_t File::size() const {
-  auto f_mut = const_cast<std::ifstream *>(&f_);
-  auto current_pos = f_mut->tellg();
-  f_mut->seekg(0, std::ios::end);
-  auto file_size = static_cast<size_t>(f_mut->tellg());
-  f_mut->seekg(current_pos);
-  return file_size;
+template<typename Codec>
+void BasicBlock<Codec>::verify(std::span<const std::byte> raw) {
+  if (raw.size() < BLOCK_TRAILER_SIZE) {
+    throw CorruptionError("Block too small");
+  }
+  auto contents = raw.first(raw.size() - BLOCK_TRAILER_SIZE);
+  uint32_t expected = *reinterpret_cast<const uint32_t *>(raw.data() + contents.size());
+  if (checksum::crc32c(contents) != expected) {
+    throw CorruptionError("Block checksum mismatch");
+  }
 }
 
-void File::read(std::span<std::byte> buf, size_t offset, size_t len) {
-  if (!f_.is_open()) {
-    throw std::runtime_error("File is not open");
+// fixed width codecs decode stored keys without looking at their length
+template<typename Codec>
+static void check_key_len(uint32_t key_len) {
+  if constexpr (requires { Codec::WIDTH; }) {
+    if (key_len != Codec::WIDTH) {
+      // e.g. a table written with a different key codec
+      throw CorruptionError(std::format("Block holds a {0} byte key, expected {1}", key_len, Codec::WIDTH));
+    }
   }
-  if (len > buf.size()) {
-    throw std::invalid_argument("Buffer too small for requested read length");
+}
+
+static std::string encode_operands(const std::vector<std::string>& operands) {
+  std::string result;
+  for (const auto& operand : operands) {
+    uint32_t len = static_cast<uint32_t>(operand.size());
+    result.append(reinterpret_cast<const char *>(&len), 4);
+    result.append(operand);
   }
-  auto f_mut = const_cast<std::ifstream *>(&f_);
-  f_mut->seekg(offset);
-  f_mut->read(reinterpret_cast<char *>(buf.data()), len);
-  if (f_mut->fail() && !f_mut->eof()) {
-    throw std::runtime_error("Failed to read from file");
+  return result;
+}
+
+static std::vector<std::string> decode_operands(const std::byte *data, size_t size) {
+  std::vector<std::string> operands;
+  size_t offset = 0;
+  while (offset + 4 <= size) {
+    uint32_t len = *reinterpret_cast<const uint32_t *>(data + offset);
+    offset += 4;
+    if (offset + len > size) break;
+    operands.emplace_back(reinterpret_cast<const char *>(data + offset), len);
+    offset += len;
   }
+  return operands;
 }
 
-Block Block::from_raw(std::span<std::byte> raw) {
-  Block b;
-  b.data_.assign(raw.begin(), raw.end());
-  return b;
+template<typename Codec>
+void BasicBlock<Codec>::for_each(const std::function<bool(std::string_view key, const Entry& entry)>& f) const {
+  size_t offset = 0;
+  while (offset + 8 <= data_.size()) {
+    uint32_t key_len = *reinterpret_cast<const uint32_t *>(data_.data() + offset);
+    offset += 4;
+    if (key_len == 0) break;
+    check_key_len<Codec>(key_len);
+    if (offset + key_len + 4 > data_.size()) break;
+    std::string_view k(reinterpret_cast<const char *>(data_.data() + offset), key_len);
+    offset += key_len;
+    uint32_t val_len = *reinterpret_cast<const uint32_t *>(data_.data() + offset);
+    offset += 4;
+    bool merge = val_len & MERGE_FLAG;
+    val_len &= ~MERGE_FLAG;
+    if (offset + val_len > data_.size()) break;
+    Entry entry;
+    if (merge) {
+      entry.operands = decode_operands(data_.data() + offset, val_len);
+    } else {
+      entry.value = std::string(reinterpret_cast<const char *>(data_.data() + offset), val_len);
+    }
+    offset += val_len;
+    if (!f(k, entry)) break;
+  }
 }
 
-std::optional<std::string> Block::get(const std::string& key) const {
+template<typename Codec>
+std::optional<Entry> BasicBlock<Codec>::get(const Key& key) const {
+  // entries are sorted, so stop at the first key past the one we want
   size_t offset = 0;
   while (offset + 8 <= data_.size()) {
     uint32_t key_len = *reinterpret_cast<const uint32_t *>(data_.data() + offset);
     offset += 4;
     if (key_len == 0) break;
+    check_key_len<Codec>(key_len);
     if (offset + key_len + 4 > data_.size()) break;
-    std::string k(reinterpret_cast<const char *>(data_.data() + offset), key_len);
+    std::string_view k(reinterpret_cast<const char *>(data_.data() + offset), key_len);
     offset += key_len;
     uint32_t val_len = *reinterpret_cast<const uint32_t *>(data_.data() + offset);
     offset += 4;
+    bool merge = val_len & MERGE_FLAG;
+    val_len &= ~MERGE_FLAG;
     if (offset + val_len > data_.size()) break;
-    std::string v(reinterpret_cast<const char *>(data_.data() + offset), val_len);
+    auto order = Codec::compare(k, key);
+    if (order == 0) {
+      Entry entry;
+      if (merge) {
+        entry.operands = decode_operands(data_.data() + offset, val_len);
+      } else {
+        entry.value = std::string(reinterpret_cast<const char *>(data_.data() + offset), val_len);
+      }
+      return entry;
+    }
+    if (order > 0) break;
     offset += val_len;
-    if (k == key) return v;
   }
   return std::nullopt;
 }
 
 // BlockBuilder implementation
 
-bool BlockBuilder::push(const std::string& key, const std::string& value) {
+template<typename Codec>
+bool BasicBlockBuilder<Codec>::push(const Key& k, const std::string& value, bool merge) {
+  decltype(auto) key = Codec::encode(k);
   uint32_t key_len = static_cast<uint32_t>(key.size());
   uint32_t val_len = static_cast<uint32_t>(value.size());
   size_t needed = 4 + key_len + 4 + val_len;
-  if (!data_.empty() && data_.size() + needed > BLOCK_SIZE) {
+  if (merge) val_len |= MERGE_FLAG;
+  size_t capacity = block_size_ - BLOCK_TRAILER_SIZE;
+  if (needed > capacity) {
+    throw std::invalid_argument(std::format("Entry of {0} bytes does not fit in a {1} byte block", needed, block_size_));
+  }
+  if (data_.size() + needed > capacity) {
     return false;
   }
   auto *kp = reinterpret_cast<const std::byte *>(&key_len);
@@ -119,8 +230,12 @@ bool BlockBuilder::push(const std::string& key, const std::string& value) {
   return true;
 }
 
-std::vector<std::byte> BlockBuilder::build() {
-  data_.resize(BLOCK_SIZE, std::byte(0));
+template<typename Codec>
+std::vector<std::byte> BasicBlockBuilder<Codec>::build() {
+  data_.resize(block_size_ - BLOCK_TRAILER_SIZE, std::byte(0));
+  uint32_t crc = checksum::crc32c(data_);
+  auto *cp = reinterpret_cast<const std::byte *>(&crc);
+  data_.insert(data_.end(), cp, cp + BLOCK_TRAILER_SIZE);
   std::vector<std::byte> result;
   std::swap(result, data_);
   return result;
@@ -128,23 +243,31 @@ std::vector<std::byte> BlockBuilder::build() {
 
 // Metadata implementation
 
-Metadata Metadata::from_raw(std::span<std::byte> raw) {
-  Metadata m;
+template<typename Codec>
+BasicMetadata<Codec> BasicMetadata<Codec>::from_raw(std::span<std::byte> raw) {
+  BasicMetadata m;
   size_t offset = 0;
   while (offset + 4 <= raw.size()) {
     uint32_t key_len = *reinterpret_cast<const uint32_t *>(raw.data() + offset);
     offset += 4;
     if (offset + key_len > raw.size()) break;
-    std::string key(reinterpret_cast<const char *>(raw.data() + offset), key_len);
+    std::string_view key(reinterpret_cast<const char *>(raw.data() + offset), key_len);
     offset += key_len;
-    m.first_keys_.push_back(key);
+    try {
+      m.first_keys_.push_back(Codec::decode(key));
+    } catch (const std::invalid_argument& e) {
+      // e.g. a table written with a different key codec
+      throw CorruptionError(std::format("Metadata holds an invalid key: {0}", e.what()));
+    }
   }
   return m;
 }
 
-std::vector<std::byte> Metadata::to_raw() const {
+template<typename Codec>
+std::vector<std::byte> BasicMetadata<Codec>::to_raw() const {
   std::vector<std::byte> result;
-  for (const auto& key : first_keys_) {
+  for (const auto& first_key : first_keys_) {
+    decltype(auto) key = Codec::encode(first_key);
     uint32_t key_len = static_cast<uint32_t>(key.size());
     auto *p = reinterpret_cast<const std::byte *>(&key_len);
     result.insert(result.end(), p, p + 4);
@@ -153,22 +276,65 @@ std::vector<std::byte> Metadata::to_raw() const {
   return result;
 }
 
-size_t Metadata::lookup_block(const std::string& key) const {
+template<typename Codec>
+size_t BasicMetadata<Codec>::size_bytes() const {
+  if constexpr (std::is_integral_v<Key>) {
+    return first_keys_.size() * sizeof(Key);
+  } else {
+    size_t size = 0;
+    for (const auto& key : first_keys_) {
+      size += key.size() + sizeof(Key);
+    }
+    return size;
+  }
+}
+
+template<typename Codec>
+size_t BasicMetadata<Codec>::lookup_block(const Key& key) const {
   if (first_keys_.empty()) return 0;
-  auto it = std::upper_bound(first_keys_.begin(), first_keys_.end(), key);
-  if (it == first_keys_.begin()) return 0;
-  --it;
-  return static_cast<size_t>(it - first_keys_.begin());
+  if constexpr (std::is_integral_v<Key>) {
+    // branch-free search for the last first key <= key: the loop runs log2(n) times whatever
+    // the keys are, and the step compiles to a conditional move
+    const Key *base = first_keys_.data();
+    size_t n = first_keys_.size();
+    while (n > 1) {
+      size_t half = n / 2;
+      base = base[half] <= key ? base + half : base;
+      n -= half;
+    }
+    return static_cast<size_t>(base - first_keys_.data());
+  } else {
+    auto it = std::upper_bound(first_keys_.begin(), first_keys_.end(), key);
+    if (it == first_keys_.begin()) return 0;
+    --it;
+    return static_cast<size_t>(it - first_keys_.begin());
+  }
 }
 
 FileIndex FileIndex::from_raw(std::span<std::byte> raw) {
-  assert(raw.size() == FileIndex::SIZE);
+  if (raw.size() != FileIndex::SIZE) {
+    throw CorruptionError("File index has the wrong size");
+  }
+  uint32_t version = *reinterpret_cast<const uint32_t *>(raw.data() + SIZE - 2 * sizeof(uint32_t));
+  if (version != FORMAT_VERSION) {
+    throw CorruptionError(std::format("Unsupported SSTable format version {0}", version));
+  }
+  uint32_t expected = *reinterpret_cast<const uint32_t *>(raw.data() + SIZE - sizeof(uint32_t));
+  if (checksum::crc32c(raw.first(SIZE - sizeof(uint32_t))) != expected) {
+    throw CorruptionError("File index checksum mismatch");
+  }
   FileIndex fi;
   size_t offset = 0;
-  fi.block_size = *reinterpret_cast<const uint16_t *>(raw.data() + offset);
-  offset += sizeof(uint16_t);
+  fi.block_size = *reinterpret_cast<const uint32_t *>(raw.data() + offset);
+  offset += sizeof(uint32_t);
   fi.num_blocks = *reinterpret_cast<const uint32_t *>(raw.data() + offset);
   offset += sizeof(uint32_t);
+  fi.range_tombstones_size = *reinterpret_cast<const uint32_t *>(raw.data() + offset);
+  offset += sizeof(uint32_t);
+  fi.metadata_crc = *reinterpret_cast<const uint32_t *>(raw.data() + offset);
+  offset += sizeof(uint32_t);
+  fi.range_tombstones_crc = *reinterpret_cast<const uint32_t *>(raw.data() + offset);
+  offset += sizeof(uint32_t);
   fi.id = *reinterpret_cast<const size_t *>(raw.data() + offset);
   return fi;
 }
@@ -176,94 +342,494 @@ FileIndex FileIndex::from_raw(std::span<std::byte> raw) {
 std::vector<std::byte> FileIndex::to_raw() const {
   std::vector<std::byte> result(SIZE);
   size_t offset = 0;
-  *reinterpret_cast<uint16_t *>(result.data() + offset) = block_size;
-  offset += sizeof(uint16_t);
+  *reinterpret_cast<uint32_t *>(result.data() + offset) = block_size;
+  offset += sizeof(uint32_t);
   *reinterpret_cast<uint32_t *>(result.data() + offset) = num_blocks;
   offset += sizeof(uint32_t);
+  *reinterpret_cast<uint32_t *>(result.data() + offset) = range_tombstones_size;
+  offset += sizeof(uint32_t);
+  *reinterpret_cast<uint32_t *>(result.data() + offset) = metadata_crc;
+  offset += sizeof(uint32_t);
+  *reinterpret_cast<uint32_t *>(result.data() + offset) = range_tombstones_crc;
+  offset += sizeof(uint32_t);
   *reinterpret_cast<size_t *>(result.data() + offset) = id;
+  offset += sizeof(size_t);
+  *reinterpret_cast<uint32_t *>(result.data() + offset) = FORMAT_VERSION;
+  offset += sizeof(uint32_t);
+  *reinterpret_cast<uint32_t *>(result.data() + offset) = checksum::crc32c(std::span(result).first(offset));
   return result;
 }
 
-SSTable SSTable::from_memtable(size_t id, std::filesystem::path directory,
-                               const MemTable<Immutable>& memtable) {
-  logging::log(std::format("Creating SSTable with id {0}", id));
-  SSTable sstable;
-  sstable.id_ = id;
-  auto filename = std::format("sstable-{0}.sst", id);
-  auto file_path = directory / filename;
-
-  std::vector<std::byte> file_contents;
-  Metadata metadata;
-  BlockBuilder builder;
-
-  for (auto const& [k, v] : memtable.memtable_) {
-    bool was_empty = builder.empty();
-    if (!builder.push(k, v)) {
-      // Block is full: flush and start a new one
-      auto block = builder.build();
-      file_contents.insert(file_contents.end(), block.begin(), block.end());
-      metadata.add_first_key(k);
-      builder.push(k, v); // guaranteed to fit in a fresh block
-    } else if (was_empty) {
-      metadata.add_first_key(k);
+static std::filesystem::path table_path(std::filesystem::path directory, size_t id) {
+  return directory / std::format("sstable-{0}.sst", id);
+}
+
+// tables are written under this name and renamed into place once complete,
+// so readers listing the directory never see a partial table
+static std::filesystem::path temp_path(std::filesystem::path path) {
+  path += ".tmp";
+  return path;
+}
+
+template<typename Codec>
+bool BasicSSTable<Codec>::is_table_file(const std::filesystem::path& path) {
+  return path.extension() == ".sst";
+}
+
+template<typename Codec>
+std::optional<size_t> BasicSSTable<Codec>::table_id(const std::filesystem::path& path) {
+  // the inverse of table_path
+  constexpr std::string_view prefix = "sstable-";
+  if (!is_table_file(path)) {
+    return std::nullopt;
+  }
+  auto stem = path.stem().string();
+  if (!stem.starts_with(prefix)) {
+    return std::nullopt;
+  }
+  size_t id;
+  auto [end, ec] = std::from_chars(stem.data() + prefix.size(), stem.data() + stem.size(), id);
+  if (ec != std::errc{} || end != stem.data() + stem.size()) {
+    return std::nullopt;
+  }
+  return id;
+}
+
+template<typename Codec>
+BasicSSTable<Codec> BasicSSTable<Codec>::from_memtable(size_t id, std::filesystem::path directory,
+                                                       const MemTable<Immutable, Codec>& memtable,
+                                                       const MergeOperator& merge_operator, size_t block_size,
+                                                       RateLimiter* rate_limiter) {
+  return from_memtables(id, directory, {&memtable}, merge_operator, block_size, rate_limiter);
+}
+
+template<typename Codec>
+BasicSSTable<Codec> BasicSSTable<Codec>::from_memtables(size_t id, std::filesystem::path directory,
+                                                        const std::vector<const MemTable<Immutable, Codec>*>& memtables,
+                                                        const MergeOperator& merge_operator, size_t block_size,
+                                                        RateLimiter* rate_limiter, const OlderValue& older_value) {
+  logging::log(std::format("Creating SSTable with id {0} from {1} memtables", id, memtables.size()));
+  BasicSSTableWriter<Codec> writer(table_path(directory, id), id, block_size, rate_limiter);
+
+  // the table's range tombstones hide older tables, so they are the union of every memtable's
+  RangeTombstones range_tombstones;
+  for (auto memtable : memtables) {
+    for (auto const& [begin, end] : memtable->range_tombstones_.ranges()) {
+      range_tombstones.add(begin, end);
     }
   }
 
-  if (!builder.empty()) {
-    auto block = builder.build();
-    file_contents.insert(file_contents.end(), block.begin(), block.end());
+  // one cursor over values and one over merge operands per memtable
+  struct Cursor {
+    typename std::map<Key, std::string>::const_iterator value_it, value_end;
+    typename std::map<Key, Operands>::const_iterator merge_it, merge_end;
+  };
+  std::vector<Cursor> cursors;
+  for (auto memtable : memtables) {
+    cursors.push_back({memtable->memtable_.begin(), memtable->memtable_.end(),
+                       memtable->merges_.begin(), memtable->merges_.end()});
   }
 
-  uint32_t num_blocks = static_cast<uint32_t>(file_contents.size() / BLOCK_SIZE);
+  // visit keys in order, taking each memtable's entry for the key
+  std::vector<Entry> entries(memtables.size());
+  std::vector<size_t> operand_bytes(memtables.size());
+  while (true) {
+    const Key* next = nullptr;
+    for (auto const& cursor : cursors) {
+      if (cursor.value_it != cursor.value_end && (!next || cursor.value_it->first < *next)) next = &cursor.value_it->first;
+      if (cursor.merge_it != cursor.merge_end && (!next || cursor.merge_it->first < *next)) next = &cursor.merge_it->first;
+    }
+    if (!next) {
+      break;
+    }
+    const Key& k = *next;
+    decltype(auto) encoded = Codec::encode(k);
+    for (size_t i = 0; i < cursors.size(); i++) {
+      auto& cursor = cursors[i];
+      entries[i] = Entry{};
+      operand_bytes[i] = 0;
+      if (cursor.value_it != cursor.value_end && cursor.value_it->first == k) {
+        entries[i].value = (cursor.value_it++)->second;
+      }
+      if (cursor.merge_it != cursor.merge_end && cursor.merge_it->first == k) {
+        entries[i].operands = cursor.merge_it->second.list;
+        operand_bytes[i] = (cursor.merge_it++)->second.encoded_bytes;
+      }
+    }
 
-  auto meta_raw = metadata.to_raw();
-  file_contents.insert(file_contents.end(), meta_raw.begin(), meta_raw.end());
+    // newest first, as in LSMKVStore::get; a range tombstone in a memtable is a base for older operands
+    std::vector<std::string> operands;
+    size_t list_bytes = 0;
+    std::optional<std::string> base;
+    bool has_base = false;
+    for (size_t i = memtables.size(); i-- > 0; ) {
+      operands.insert(operands.begin(), entries[i].operands.begin(), entries[i].operands.end());
+      list_bytes += operand_bytes[i];
+      if (entries[i].value.has_value()) {
+        has_base = true;
+        if (!entries[i].value->empty()) base = entries[i].value;
+        break;
+      }
+      if (memtables[i]->range_tombstones_.covers(encoded)) {
+        has_base = true;
+        break;
+      }
+    }
 
-  FileIndex fi;
-  fi.block_size = static_cast<uint16_t>(BLOCK_SIZE);
-  fi.num_blocks = num_blocks;
-  fi.id = id;
-  auto fi_raw = fi.to_raw();
-  file_contents.insert(file_contents.end(), fi_raw.begin(), fi_raw.end());
+    if (!has_base) {
+      // an operand list too long for a block is resolved against the older tables instead,
+      // which makes the result a plain value that supersedes them
+      if (list_bytes <= max_value_size(block_size, Codec::size(k)) || !older_value) {
+        writer.add_merge(k, operands);
+        continue;
+      }
+      base = older_value(k);
+      if (base.has_value() && base->empty()) base = std::nullopt;
+    }
+    if (!operands.empty()) {
+      if (!merge_operator) {
+        throw std::logic_error("Merge operands present but no merge operator configured");
+      }
+      // a result that does not fit fails the table
+      writer.add(k, merge_operator(encoded, base, operands));
+    } else if (base.has_value()) {
+      writer.add(k, base.value());
+    } else if (!range_tombstones.covers(encoded)) {
+      // deleted keys the table's range tombstones already hide need no entry
+      writer.add(k, "");
+    }
+  }
 
-  sstable.file_index_ = fi;
-  sstable.metadata_ = metadata;
-  sstable.file_ = File::create(file_path, file_contents);
-  return sstable;
+  for (auto const& [begin, end] : range_tombstones.ranges()) {
+    writer.add_range_tombstone(Codec::decode(begin), Codec::decode(end));
+  }
+  return writer.finish();
 }
 
-SSTable SSTable::from_file(std::filesystem::path filepath) {
-  SSTable sstable;
-  sstable.file_ = File::open(filepath);
+template<typename Codec>
+std::filesystem::path BasicSSTable<Codec>::stage_external_file(std::filesystem::path filepath,
+                                                               std::filesystem::path directory, size_t id) {
+  logging::log(std::format("Ingesting {0} as SSTable with id {1}", filepath.string(), id));
+  auto target = table_path(directory, id);
+  auto temp = temp_path(target);
+  std::error_code ec;
+  std::filesystem::rename(filepath, temp, ec);
+  if (ec) {
+    // rename fails across filesystems, fall back to a copy
+    std::filesystem::copy_file(filepath, temp, std::filesystem::copy_options::overwrite_existing);
+  }
 
-  auto file_size = sstable.file_.size();
+  try {
+    // the id lives in the file index at the very end of the file
+    std::fstream f(temp, std::ios::in | std::ios::out | std::ios::binary);
+    if (!f.is_open()) {
+      throw std::runtime_error("Failed to open file: " + temp.string());
+    }
+    f.seekg(0, std::ios::end);
+    auto file_size = static_cast<size_t>(f.tellg());
+    if (file_size < FileIndex::SIZE) {
+      throw std::runtime_error("Not an SSTable: " + filepath.string());
+    }
+    std::vector<std::byte> fi_bytes(FileIndex::SIZE);
+    f.seekg(file_size - FileIndex::SIZE);
+    f.read(reinterpret_cast<char *>(fi_bytes.data()), FileIndex::SIZE);
+    auto fi = FileIndex::from_raw(fi_bytes);
+    fi.id = id;
+    fi_bytes = fi.to_raw();
+    f.seekp(file_size - FileIndex::SIZE);
+    f.write(reinterpret_cast<const char *>(fi_bytes.data()), FileIndex::SIZE);
+    f.close();
+    if (f.fail()) {
+      throw std::runtime_error("Failed to rewrite file index of " + filepath.string());
+    }
+  } catch (...) {
+    unstage_external_file(temp, filepath);
+    throw;
+  }
+  return temp;
+}
+
+template<typename Codec>
+BasicSSTable<Codec> BasicSSTable<Codec>::publish_external_file(const std::filesystem::path& staged) {
+  auto target = staged;
+  target.replace_extension();
+  std::filesystem::rename(staged, target);
+  return from_file(target);
+}
+
+template<typename Codec>
+void BasicSSTable<Codec>::unstage_external_file(const std::filesystem::path& staged,
+                                                const std::filesystem::path& filepath) noexcept {
+  std::error_code ec;
+  if (std::filesystem::exists(filepath, ec)) {
+    // staged by copying, the original is still in place
+    std::filesystem::remove(staged, ec);
+  } else {
+    std::filesystem::rename(staged, filepath, ec);
+  }
+  if (ec) {
+    logging::log(std::format("Failed to restore {0}: {1}", filepath.string(), ec.message()));
+  }
+}
+
+// the sections after the data blocks, checked against the checksums in the file index
+struct Sections {
+  FileIndex file_index;
+  std::vector<std::byte> metadata;
+  std::vector<std::byte> range_tombstones;
+};
+
+static Sections read_sections(const File& file) {
+  Sections sections;
+  auto file_size = file.size();
+  if (file_size < FileIndex::SIZE) {
+    throw CorruptionError("File too small to be an SSTable: " + file.path().string());
+  }
 
   // Read FileIndex from end
   std::vector<std::byte> fi_bytes(FileIndex::SIZE);
-  sstable.file_.read(fi_bytes, file_size - FileIndex::SIZE, FileIndex::SIZE);
-  sstable.file_index_ = FileIndex::from_raw(fi_bytes);
-  sstable.id_ = sstable.file_index_.id;
+  file.read(fi_bytes, file_size - FileIndex::SIZE, FileIndex::SIZE);
+  sections.file_index = FileIndex::from_raw(fi_bytes);
 
-  // Metadata sits between data blocks and file index
-  size_t data_end = static_cast<size_t>(sstable.file_index_.num_blocks) * sstable.file_index_.block_size;
-  size_t meta_size = file_size - FileIndex::SIZE - data_end;
-  std::vector<std::byte> meta_bytes(meta_size);
+  // Metadata and range tombstones sit between data blocks and file index
+  if (sections.file_index.block_size < MIN_BLOCK_SIZE || sections.file_index.block_size > MAX_BLOCK_SIZE) {
+    throw CorruptionError("Invalid block size: " + file.path().string());
+  }
+  size_t data_end = static_cast<size_t>(sections.file_index.num_blocks) * sections.file_index.block_size;
+  size_t tombstones_size = sections.file_index.range_tombstones_size;
+  if (data_end + tombstones_size + FileIndex::SIZE > file_size) {
+    throw CorruptionError("File index does not match file size: " + file.path().string());
+  }
+  size_t meta_size = file_size - FileIndex::SIZE - tombstones_size - data_end;
+  sections.metadata.resize(meta_size);
   if (meta_size > 0) {
-    sstable.file_.read(meta_bytes, data_end, meta_size);
+    file.read(sections.metadata, data_end, meta_size);
+  }
+  if (checksum::crc32c(sections.metadata) != sections.file_index.metadata_crc) {
+    throw CorruptionError("Metadata checksum mismatch: " + file.path().string());
   }
-  sstable.metadata_ = Metadata::from_raw(meta_bytes);
+
+  sections.range_tombstones.resize(tombstones_size);
+  if (tombstones_size > 0) {
+    file.read(sections.range_tombstones, data_end + meta_size, tombstones_size);
+  }
+  if (checksum::crc32c(sections.range_tombstones) != sections.file_index.range_tombstones_crc) {
+    throw CorruptionError("Range tombstone checksum mismatch: " + file.path().string());
+  }
+  return sections;
+}
+
+template<typename Codec>
+BasicSSTable<Codec> BasicSSTable<Codec>::from_file(std::filesystem::path filepath) {
+  BasicSSTable sstable;
+  sstable.file_ = File::open(filepath);
+
+  auto sections = read_sections(sstable.file_);
+  sstable.file_index_ = sections.file_index;
+  sstable.id_ = sstable.file_index_.id;
+  sstable.metadata_ = BasicMetadata<Codec>::from_raw(sections.metadata);
+  sstable.range_tombstones_ = RangeTombstones::from_raw(sections.range_tombstones);
+  sstable.verified_blocks_ = std::make_shared<std::vector<std::atomic<bool>>>(sstable.file_index_.num_blocks);
 
   return sstable;
 }
 
-std::optional<std::string> SSTable::get(std::string key) {
-  if (file_index_.num_blocks == 0) return std::nullopt;
+template<typename Codec>
+std::optional<Entry> BasicSSTable<Codec>::get(const Key& key, ChecksumVerification verification) {
+  if (file_index_.num_blocks > 0) {
+    size_t block_idx = metadata_.lookup_block(key);
+
+    std::vector<std::byte> block_data(file_index_.block_size);
+    file_.read(block_data, block_idx * static_cast<size_t>(file_index_.block_size), file_index_.block_size);
+
+    if (verification == ChecksumVerification::Always) {
+      BasicBlock<Codec>::verify(block_data);
+    } else if (verification == ChecksumVerification::OnFirstLoad) {
+      auto& verified = (*verified_blocks_)[block_idx];
+      if (!verified.load(std::memory_order_acquire)) {
+        BasicBlock<Codec>::verify(block_data);
+        verified.store(true, std::memory_order_release);
+      }
+    }
+
+    auto block = BasicBlock<Codec>::from_raw(std::move(block_data));
+    auto result = block.get(key);
+    if (result.has_value()) {
+      if (!result->value.has_value() && !range_tombstones_.empty() && range_tombstones_.covers(Codec::encode(key))) {
+        result->value = std::string{};
+      }
+      return result;
+    }
+  }
+  // a covered key reads as a tombstone so older tables are not consulted
+  if (!range_tombstones_.empty() && range_tombstones_.covers(Codec::encode(key))) return Entry{std::string{}, {}};
+  return std::nullopt;
+}
+
+template<typename Codec>
+void BasicSSTable<Codec>::verify() const {
+  const File& file = file_;
+  auto sections = read_sections(file);
+  auto& fi = sections.file_index;
+  std::vector<std::byte> block_data(fi.block_size);
+  for (size_t i = 0; i < fi.num_blocks; i++) {
+    file.read(block_data, i * static_cast<size_t>(fi.block_size), fi.block_size);
+    try {
+      BasicBlock<Codec>::verify(block_data);
+    } catch (const CorruptionError&) {
+      throw CorruptionError(std::format("Block {0} checksum mismatch: {1}", i, file.path().string()));
+    }
+    if constexpr (requires { Codec::WIDTH; }) {
+      try {
+        // reads only look at the keys they walk past, check every one here
+        BasicBlock<Codec>::from_raw(std::span(block_data)).for_each([](std::string_view, const Entry&) {
+          return true;
+        });
+      } catch (const CorruptionError& e) {
+        throw CorruptionError(std::format("{1} in block {0}: {2}", i, e.what(), file.path().string()));
+      }
+    }
+  }
+}
 
-  size_t block_idx = metadata_.lookup_block(key);
+template<typename Codec>
+void BasicSSTable<Codec>::scan(const std::function<void(std::string_view key, const Entry& entry)>& f) const {
+  size_t block_size = file_index_.block_size;
+  for (size_t i = 0; i < file_index_.num_blocks; i++) {
+    std::vector<std::byte> block_data(block_size);
+    file_.read(block_data, i * block_size, block_size);
+    BasicBlock<Codec>::from_raw(std::move(block_data)).for_each([&](std::string_view key, const Entry& entry) {
+      f(key, entry);
+      return true;
+    });
+  }
+}
 
-  std::vector<std::byte> block_data(file_index_.block_size);
-  file_.read(block_data, block_idx * file_index_.block_size, file_index_.block_size);
+// SSTableWriter implementation
 
-  Block block = Block::from_raw(block_data);
-  return block.get(key);
+template<typename Codec>
+BasicSSTableWriter<Codec>::BasicSSTableWriter(std::filesystem::path path, size_t id, size_t block_size,
+                                              RateLimiter* rate_limiter)
+    : path_{path}, id_{id}, rate_limiter_{rate_limiter}, builder_{block_size} {
+  if (block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE) {
+    throw std::invalid_argument(std::format("Invalid block size {0}", block_size));
+  }
+  out_.open(temp_path(path_), std::ios::out | std::ios::trunc | std::ios::binary);
+  if (!out_.is_open()) {
+    throw std::runtime_error(std::format("Failed to create file {0} for writing", path_.string()));
+  }
 }
+
+template<typename Codec>
+void BasicSSTableWriter<Codec>::add(const Key& key, const std::string& value) {
+  push(key, value, false);
+}
+
+template<typename Codec>
+void BasicSSTableWriter<Codec>::add_merge(const Key& key, const std::vector<std::string>& operands) {
+  push(key, encode_operands(operands), true);
+}
+
+template<typename Codec>
+void BasicSSTableWriter<Codec>::push(const Key& key, const std::string& value, bool merge) {
+  if (finished_) {
+    throw std::logic_error("SSTableWriter::add called after finish");
+  }
+  if (last_key_.has_value() && key <= last_key_.value()) {
+    throw std::invalid_argument(std::format("Keys must be strictly increasing, got {0} after {1}", key, last_key_.value()));
+  }
+  bool was_empty = builder_.empty();
+  if (!builder_.push(key, value, merge)) {
+    // Block is full: write it out and start a new one
+    write_block();
+    metadata_.add_first_key(key);
+    builder_.push(key, value, merge); // guaranteed to fit in a fresh block
+  } else if (was_empty) {
+    metadata_.add_first_key(key);
+  }
+  last_key_ = key;
+}
+
+template<typename Codec>
+void BasicSSTableWriter<Codec>::add_range_tombstone(const Key& begin, const Key& end) {
+  if (finished_) {
+    throw std::logic_error("SSTableWriter::add_range_tombstone called after finish");
+  }
+  range_tombstones_.add(Codec::encode(begin), Codec::encode(end));
+}
+
+template<typename Codec>
+void BasicSSTableWriter<Codec>::write(std::span<const std::byte> data) {
+  if (rate_limiter_ != nullptr) {
+    rate_limiter_->request(data.size());
+  }
+  out_.write(reinterpret_cast<const char *>(data.data()), data.size());
+}
+
+template<typename Codec>
+void BasicSSTableWriter<Codec>::write_block() {
+  auto block = builder_.build();
+  write(block);
+  num_blocks_++;
+}
+
+template<typename Codec>
+BasicSSTableWriter<Codec>::~BasicSSTableWriter() {
+  // a table abandoned or failed part way must not pile up in the directory
+  if (!finished_) {
+    out_.close();
+    std::error_code ec;
+    std::filesystem::remove(temp_path(path_), ec);
+  }
+}
+
+template<typename Codec>
+BasicSSTable<Codec> BasicSSTableWriter<Codec>::finish() {
+  if (finished_) {
+    throw std::logic_error("SSTableWriter::finish called twice");
+  }
+  if (!builder_.empty()) {
+    write_block();
+  }
+
+  auto meta_raw = metadata_.to_raw();
+  write(meta_raw);
+  auto tombstones_raw = range_tombstones_.to_raw();
+  write(tombstones_raw);
+
+  FileIndex fi;
+  fi.block_size = static_cast<uint32_t>(builder_.block_size());
+  fi.num_blocks = num_blocks_;
+  fi.range_tombstones_size = static_cast<uint32_t>(tombstones_raw.size());
+  fi.metadata_crc = checksum::crc32c(meta_raw);
+  fi.range_tombstones_crc = checksum::crc32c(tombstones_raw);
+  fi.id = id_;
+  auto fi_raw = fi.to_raw();
+  write(fi_raw);
+  out_.close();
+  if (out_.fail()) {
+    throw std::runtime_error(std::format("Failed to write file {0}", path_.string()));
+  }
+  std::filesystem::rename(temp_path(path_), path_);
+  finished_ = true;
+
+  BasicSSTable<Codec> sstable;
+  sstable.id_ = id_;
+  sstable.file_index_ = fi;
+  sstable.metadata_ = std::move(metadata_);
+  sstable.range_tombstones_ = std::move(range_tombstones_);
+  sstable.verified_blocks_ = std::make_shared<std::vector<std::atomic<bool>>>(num_blocks_);
+  sstable.file_ = File::open(path_);
+  return sstable;
+}
+
+template class BasicBlock<StringKey>;
+template class BasicBlock<U64Key>;
+template class BasicBlockBuilder<StringKey>;
+template class BasicBlockBuilder<U64Key>;
+template class BasicMetadata<StringKey>;
+template class BasicMetadata<U64Key>;
+template class BasicSSTable<StringKey>;
+template class BasicSSTable<U64Key>;
+template class BasicSSTableWriter<StringKey>;
+template class BasicSSTableWriter<U64Key>;
@@ -1,8 +1,16 @@
 #include "include/db.hpp"
+#include "include/checksum.hpp"
+#include <atomic>
 #include <filesystem>
 #include <gtest/gtest.h>
+#include <future>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
 #include <optional>
+#include <ranges>
 #include <stdexcept>
+#include <thread>
 
 enum Cleanup {
     Manual = 0,
@@ -114,3 +122,734 @@ TEST(DB, TEST_DELETE) {
         }  
     }
 }
+
+TEST(DB, TEST_INGEST) {
+    auto name = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+    auto path = std::filesystem::path("./test").append(name);
+    TestDir<Auto> dir(path);
+    auto key = [](size_t i) {return std::format("key{:05d}", i); };
+    constexpr int keys = 2000;
+    KVStoreConfig config(512, dir.directory() / "db");
+    auto external = dir.directory() / "external.sst";
+    {
+        SSTableWriter writer(external);
+        for (size_t i = 0; i < keys; i++) {
+            writer.add(key(i), std::format("ingested{:05d}", i));
+        }
+        ASSERT_THROW(writer.add(key(0), "out of order"), std::invalid_argument);
+        writer.finish();
+    }
+    {
+        LSMKVStore db(config);
+        for (size_t i = 0; i < keys; i += 100) {
+            db.put(key(i), "old");
+        }
+        db.remove(key(1));
+        auto table_ids = [&]() {
+            std::vector<size_t> ids;
+            for (auto const& entry: std::filesystem::directory_iterator(dir.directory() / "db")) {
+                ids.push_back(SSTable::table_id(entry.path()).value());
+            }
+            std::ranges::sort(ids);
+            return ids;
+        };
+        // a failed ingest hands the files back; the memtables it flushed stay, as a follower may have
+        // loaded that table, and so does every id it handed out
+        auto tables = table_ids().size();
+        ASSERT_ANY_THROW(db.ingest({external, external}));
+        ASSERT_TRUE(std::filesystem::exists(external));
+        auto ids = table_ids();
+        ASSERT_EQ(ids.size(), tables + 1);
+        ASSERT_EQ(db.get(key(0)), "old");
+        db.ingest({external});
+        ASSERT_FALSE(std::filesystem::exists(external));
+        // the rolled back external file took the id after the memtables' table
+        ASSERT_GT(table_ids().back(), ids.back() + 1);
+        db.put(key(5), "new");
+        for (size_t i = 0; i < keys; i++) {
+            auto expected = i == 5 ? "new" : std::format("ingested{:05d}", i);
+            ASSERT_EQ(db.get(key(i)), expected);
+        }
+    }
+    {
+        LSMKVStore db(config);
+        ASSERT_EQ(db.get(key(0)), "ingested00000");
+        ASSERT_EQ(db.get(key(1)), "ingested00001");
+        ASSERT_EQ(db.get(key(5)), "new");
+    }
+}
+
+TEST(DB, TEST_REMOVE_RANGE) {
+    auto name = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+    auto path = std::filesystem::path("./test").append(name);
+    TestDir<Auto> dir(path);
+    auto key = [](size_t i) {return std::format("key{:03d}", i); };
+    auto val = [](size_t i) {return std::format("value{:03d}", i); };
+    constexpr int keys = 200;
+    std::map<std::string, std::string> ground_truth;
+    KVStoreConfig config(512, dir.directory());
+    {
+        LSMKVStore db(config);
+        for (size_t i = 0; i < keys; i++) {
+            db.put(key(i), val(i));
+            ground_truth[key(i)] = val(i);
+        }
+        // spans flushed SSTables and the active memtable
+        db.remove_range(key(20), key(180));
+        ground_truth.erase(ground_truth.lower_bound(key(20)), ground_truth.lower_bound(key(180)));
+        // writes after the range delete are visible again
+        db.put(key(50), "revived");
+        ground_truth[key(50)] = "revived";
+        for (size_t i = 0; i < keys; i++) {
+            auto gt = ground_truth.contains(key(i)) ? std::make_optional(ground_truth.at(key(i))) : std::nullopt;
+            ASSERT_EQ(db.get(key(i)), gt);
+        }
+    }
+    {
+        LSMKVStore db(config);
+        for (size_t i = 0; i < keys; i++) {
+            auto gt = ground_truth.contains(key(i)) ? std::make_optional(ground_truth.at(key(i))) : std::nullopt;
+            ASSERT_EQ(db.get(key(i)), gt);
+        }
+    }
+}
+
+TEST(DB, TEST_ROW_CACHE) {
+    auto name = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+    auto path = std::filesystem::path("./test").append(name);
+    TestDir<Auto> dir(path);
+    auto key = [](size_t i) {return std::format("key{:03d}", i); };
+    auto val = [](size_t i) {return std::format("value{:03d}", i); };
+    constexpr int keys = 100;
+    KVStoreConfig config(512, dir.directory());
+    config.row_cache_bytes_ = 1 << 16;
+    {
+        LSMKVStore db(config);
+        for (size_t i = 0; i < keys; i++) {
+            db.put(key(i), val(i));
+        }
+    }
+    LSMKVStore db(config);
+    for (int round = 0; round < 3; round++) {
+        for (size_t i = 0; i < keys; i++) {
+            ASSERT_EQ(db.get(key(i)), val(i));
+        }
+    }
+    auto stats = db.row_cache_stats().value();
+    ASSERT_EQ(stats.misses, keys);
+    ASSERT_EQ(stats.hits, 2 * keys);
+    ASSERT_GT(stats.hit_rate(), 0.6);
+
+    // writes must not leave stale rows behind
+    db.put(key(1), "updated");
+    ASSERT_EQ(db.get(key(1)), "updated");
+    db.remove(key(2));
+    ASSERT_EQ(db.get(key(2)), std::nullopt);
+    db.remove_range(key(10), key(20));
+    ASSERT_EQ(db.get(key(15)), std::nullopt);
+    ASSERT_EQ(db.get(key(30)), val(30));
+}
+
+TEST(DB, TEST_MERGE) {
+    auto name = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+    auto path = std::filesystem::path("./test").append(name);
+    TestDir<Auto> dir(path);
+    auto key = [](size_t i) {return std::format("counter{:03d}", i); };
+    constexpr int keys = 20;
+    KVStoreConfig config(256, dir.directory());
+    // counters stored as decimal strings, a counter that reaches zero is deleted
+    config.merge_operator_ = [](const std::string&, const std::optional<std::string>& base,
+                                const std::vector<std::string>& operands) {
+        long total = base.has_value() ? std::stol(base.value()) : 0;
+        for (auto& operand: operands) {
+            total += std::stol(operand);
+        }
+        return total == 0 ? std::string{} : std::to_string(total);
+    };
+    {
+        LSMKVStore db(config);
+        db.put(key(0), "100");
+        // operands land in several memtables and SSTables
+        for (int round = 0; round < 10; round++) {
+            for (size_t i = 0; i < keys; i++) {
+                db.merge(key(i), "1");
+            }
+        }
+        ASSERT_EQ(db.get(key(0)), "110");
+        ASSERT_EQ(db.get(key(1)), "10");
+        db.remove(key(2));
+        db.merge(key(2), "5");
+        ASSERT_EQ(db.get(key(2)), "5");
+        db.put(key(3), "-1");
+        ASSERT_EQ(db.get(key(3)), "-1");
+        // an empty merge result reads as deleted, before and after a flush
+        db.put(key(4), "3");
+        db.merge(key(4), "-3");
+        ASSERT_EQ(db.get(key(4)), std::nullopt);
+    }
+    {
+        LSMKVStore db(config);
+        ASSERT_EQ(db.get(key(0)), "110");
+        ASSERT_EQ(db.get(key(1)), "10");
+        ASSERT_EQ(db.get(key(2)), "5");
+        ASSERT_EQ(db.get(key(3)), "-1");
+        ASSERT_EQ(db.get(key(4)), std::nullopt);
+        ASSERT_EQ(db.get(key(keys)), std::nullopt);
+    }
+
+    // a key with both a value and operands gives its bytes back once when a range deletes it,
+    // leaving only the tombstone's bounds
+    MemTable<Mutable> memtable(1);
+    memtable.put("key", "v");
+    memtable.merge("key", "x");
+    memtable.remove_range("k", "l");
+    ASSERT_EQ(memtable.size_bytes(), 2);
+}
+
+TEST(DB, TEST_MERGE_SIZE) {
+    auto name = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+    auto path = std::filesystem::path("./test").append(name);
+    TestDir<Auto> dir(path);
+    KVStoreConfig config(1 << 20, dir.directory() / "db");
+    config.block_size_ = MIN_BLOCK_SIZE;
+    // "counter" sums its operands, every other key appends them
+    config.merge_operator_ = [](const std::string& key, const std::optional<std::string>& base,
+                                const std::vector<std::string>& operands) {
+        if (key == "counter") {
+            long total = base.has_value() ? std::stol(base.value()) : 0;
+            for (auto& operand: operands) {
+                total += std::stol(operand);
+            }
+            return std::to_string(total);
+        }
+        std::string result = base.value_or("");
+        for (auto& operand: operands) {
+            result += operand;
+        }
+        return result;
+    };
+    constexpr int increments = 1000;
+    {
+        LSMKVStore db(config);
+        db.put("counter", "0");
+        db.put("text", std::string(200, 'x'));
+    }
+    {
+        LSMKVStore db(config);
+        // far more operands than a block holds, on top of a base on disk
+        for (int i = 0; i < increments; i++) {
+            db.merge("counter", "1");
+        }
+        ASSERT_EQ(db.get("counter"), std::to_string(increments));
+        // results larger than a block are fine as long as nothing has to store them
+        db.merge("text", std::string(100, 'y'));
+        ASSERT_EQ(db.get("text"), std::string(200, 'x') + std::string(100, 'y'));
+    }
+    {
+        LSMKVStore db(config);
+        ASSERT_EQ(db.get("counter"), std::to_string(increments));
+        ASSERT_EQ(db.get("text"), std::string(200, 'x') + std::string(100, 'y'));
+    }
+
+    // a flush that would have to store a result larger than a block fails instead of dropping operands
+    MemTable<Mutable> memtable(1);
+    memtable.put("text", "x");
+    memtable.merge("text", std::string(MIN_BLOCK_SIZE, 'y'));
+    auto frozen = memtable.freeze();
+    ASSERT_THROW(SSTable::from_memtable(1, dir.directory(), frozen, config.merge_operator_, MIN_BLOCK_SIZE),
+                 std::invalid_argument);
+    ASSERT_FALSE(std::filesystem::exists(dir.directory() / "sstable-1.sst.tmp"));
+}
+
+TEST(DB, TEST_CHECKSUM) {
+    std::string check = "123456789";
+    ASSERT_EQ(checksum::crc32c(std::as_bytes(std::span(check))), 0xE3069283u);
+
+    auto name = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+    auto path = std::filesystem::path("./test").append(name);
+    TestDir<Auto> dir(path);
+    auto key = [](size_t i) {return std::format("key{:03d}", i); };
+    auto val = [](size_t i) {return std::format("value{:03d}", i); };
+    constexpr int keys = 50;
+    KVStoreConfig config(1 << 20, dir.directory());
+    {
+        LSMKVStore db(config);
+        for (size_t i = 0; i < keys; i++) {
+            db.put(key(i), val(i));
+        }
+    }
+    {
+        LSMKVStore db(config);
+        ASSERT_TRUE(db.verify_all().empty());
+    }
+
+    // flip one byte inside the only data block
+    std::filesystem::path table;
+    for (auto const& entry: std::filesystem::directory_iterator(dir.directory())) {
+        table = entry.path();
+    }
+    {
+        std::fstream f(table, std::ios::in | std::ios::out | std::ios::binary);
+        f.seekg(10);
+        char c = static_cast<char>(f.get());
+        f.seekp(10);
+        f.put(static_cast<char>(c ^ 0x1));
+    }
+    {
+        LSMKVStore db(config);
+        ASSERT_THROW(db.get(key(0)), CorruptionError);
+        ASSERT_EQ(db.verify_all().size(), 1);
+    }
+    {
+        config.checksum_verification_ = ChecksumVerification::Scrub;
+        LSMKVStore db(config);
+        ASSERT_NO_THROW(db.get(key(keys - 1)));
+    }
+}
+
+TEST(DB, TEST_BLOCK_SIZE) {
+    auto name = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+    auto path = std::filesystem::path("./test").append(name);
+    TestDir<Auto> dir(path);
+    auto key = [](size_t i) {return std::format("key{:05d}", i); };
+    auto val = [](size_t i) {return std::format("value{:05d}", i); };
+    constexpr int keys = 3000;
+    KVStoreConfig config(8192, dir.directory());
+    // tables written with different block sizes live side by side
+    for (size_t block_size: {size_t{4096}, size_t{1} << 16, size_t{1024}}) {
+        config.block_size_ = block_size;
+        LSMKVStore db(config);
+        for (size_t i = 0; i < keys; i++) {
+            db.put(key(i), std::format("{0}-{1}", val(i), block_size));
+        }
+    }
+    {
+        LSMKVStore db(config);
+        for (size_t i = 0; i < keys; i++) {
+            ASSERT_EQ(db.get(key(i)), std::format("{0}-1024", val(i)));
+        }
+        ASSERT_THROW(db.put("big", std::string(2000, 'x')), std::invalid_argument);
+    }
+    config.block_size_ = 100;
+    ASSERT_THROW(LSMKVStore db(config), std::invalid_argument);
+    // a value length could run into MERGE_FLAG
+    config.block_size_ = MERGE_FLAG;
+    ASSERT_THROW(LSMKVStore db(config), std::invalid_argument);
+}
+
+TEST(DB, TEST_MEMORY_BUDGET) {
+    auto name = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+    auto path = std::filesystem::path("./test").append(name);
+    TestDir<Auto> dir(path);
+    auto key = [](size_t i) {return std::format("key{:05d}", i); };
+    auto val = [](size_t i) {return std::format("value{:05d}", i); };
+    constexpr int keys = 2000;
+    constexpr size_t limit = 16 * 1024;
+    auto budget = std::make_shared<MemoryBudget>(limit);
+
+    // the memtable threshold alone would never flush
+    KVStoreConfig config_a(1 << 30, dir.directory() / "a");
+    KVStoreConfig config_b(1 << 30, dir.directory() / "b");
+    config_a.memory_budget_ = budget;
+    config_b.memory_budget_ = budget;
+    config_b.row_cache_bytes_ = 1 << 20;
+    {
+        LSMKVStore a(config_a);
+        LSMKVStore b(config_b);
+        for (size_t i = 0; i < keys; i++) {
+            a.put(key(i), val(i));
+            b.put(key(i), val(i));
+            ASSERT_LE(budget->usage().total(), limit);
+        }
+        for (size_t i = 0; i < keys; i++) {
+            ASSERT_EQ(b.get(key(i)), val(i));
+            ASSERT_LE(budget->usage().total(), limit);
+        }
+        auto usage = budget->usage();
+        ASSERT_GT(usage.indexes, 0);
+        ASSERT_EQ(usage.total(), a.memory_usage().total() + b.memory_usage().total());
+        ASSERT_GT(b.row_cache_stats()->evictions, 0);
+        // the cache stays capped instead of refilling past the budget
+        ASSERT_LT(b.row_cache_stats()->capacity_bytes, limit);
+        for (size_t i = 0; i < keys; i++) {
+            ASSERT_EQ(b.get(key(i)), val(i));
+        }
+        ASSERT_LE(b.row_cache_stats()->size_bytes, b.row_cache_stats()->capacity_bytes);
+    }
+    ASSERT_EQ(budget->usage().total(), 0);
+}
+
+TEST(Scheduler, TEST_PRIORITY) {
+    BackgroundScheduler scheduler(1);
+    std::mutex m;
+    std::vector<std::string> order;
+    std::promise<void> release;
+    auto blocker = release.get_future().share();
+    // occupy the only worker while the queue fills up
+    scheduler.schedule(JobPriority::High, [blocker] { blocker.wait(); });
+    auto job = [&](std::string name) {
+        return [&, name] {
+            std::lock_guard<std::mutex> g{m};
+            order.push_back(name);
+        };
+    };
+    scheduler.schedule(JobPriority::Low, job("low1"));
+    scheduler.schedule(JobPriority::High, job("high1"));
+    scheduler.schedule(JobPriority::Low, job("low2"));
+    scheduler.schedule(JobPriority::High, job("high2"));
+    release.set_value();
+    while (true) {
+        std::lock_guard<std::mutex> g{m};
+        if (order.size() == 4) break;
+    }
+    scheduler.shutdown();
+    ASSERT_EQ(order, (std::vector<std::string>{"high1", "high2", "low1", "low2"}));
+}
+
+TEST(Scheduler, TEST_RATE_LIMITER) {
+    constexpr size_t rate = 10 << 20;
+    RateLimiter limiter(rate);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 5; i++) {
+        limiter.request(1 << 20);
+    }
+    // the first request is free, the other four are paced
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    ASSERT_GE(elapsed, 0.39);
+}
+
+TEST(DB, TEST_BACKGROUND_FLUSH) {
+    auto name = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+    auto path = std::filesystem::path("./test").append(name);
+    TestDir<Auto> dir(path);
+    auto key = [](size_t i) {return std::format("key{:05d}", i); };
+    auto val = [](size_t i) {return std::format("value{:05d}", i); };
+    constexpr int keys = 2000;
+    KVStoreConfig config(512, dir.directory());
+    config.background_threads_ = 4;
+    config.background_write_bytes_per_sec_ = 64 << 20;
+    {
+        LSMKVStore db(config);
+        for (size_t i = 0; i < keys; i++) {
+            db.put(key(i), val(i));
+        }
+        ASSERT_TRUE(db.scrub().get().empty());
+        // queued flushes must not be dropped by the destructor
+    }
+    {
+        LSMKVStore db(config);
+        for (size_t i = 0; i < keys; i++) {
+            ASSERT_EQ(db.get(key(i)), val(i));
+        }
+    }
+}
+
+TEST(DB, TEST_FLUSH_ERROR) {
+    auto name = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+    auto path = std::filesystem::path("./test").append(name);
+    TestDir<Auto> dir(path);
+    auto key = [](size_t i) {return std::format("key{:05d}", i); };
+    auto val = [](size_t i) {return std::format("value{:05d}", i); };
+    // only the budget freezes the memtable, and the writer that goes over it waits for the flush
+    KVStoreConfig config(1 << 20, dir.directory());
+    config.memory_budget_ = std::make_shared<MemoryBudget>(4096);
+    // fails the flush that has to collapse operands while failing is set
+    std::atomic<bool> failing = false;
+    config.merge_operator_ = [&failing](const std::string&, const std::optional<std::string>& base,
+                                        const std::vector<std::string>& operands) {
+        if (failing) {
+            throw std::runtime_error("merge failed");
+        }
+        std::string result = base.value_or("");
+        for (auto& operand: operands) {
+            result += operand;
+        }
+        return result;
+    };
+    size_t written = 0;
+    {
+        LSMKVStore db(config);
+        db.put("counter", "a");
+        db.merge("counter", "b");
+        failing = true;
+        // writes fail once the flush has, rather than stall on memory it will never release
+        ASSERT_THROW({
+            for (; written < 100000; written++) {
+                db.put(key(written), val(written));
+            }
+        }, std::runtime_error);
+        ASSERT_THROW(db.put(key(0), val(0)), std::runtime_error);
+        ASSERT_EQ(db.get(key(0)), val(0));
+        // the destructor writes out whatever the failed flushes left queued
+        failing = false;
+    }
+    {
+        LSMKVStore db(config);
+        ASSERT_EQ(db.get("counter"), "ab");
+        for (size_t i = 0; i < written; i++) {
+            ASSERT_EQ(db.get(key(i)), val(i));
+        }
+    }
+}
+
+TEST(DB, TEST_READ_ONLY) {
+    auto name = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+    auto path = std::filesystem::path("./test").append(name);
+    TestDir<Auto> dir(path);
+    auto key = [](size_t i) {return std::format("key{:05d}", i); };
+    auto val = [](size_t i) {return std::format("value{:05d}", i); };
+    KVStoreConfig config(512, dir.directory());
+    KVStoreConfig secondary_config = config;
+    secondary_config.read_only_ = true;
+
+    // a secondary never creates the directory
+    KVStoreConfig missing_config = secondary_config;
+    missing_config.directory_ = dir.directory() / "missing";
+    ASSERT_THROW(LSMKVStore{missing_config}, std::runtime_error);
+    ASSERT_FALSE(std::filesystem::exists(missing_config.directory_));
+
+    {
+        LSMKVStore primary(config);
+        for (size_t i = 0; i < 500; i++) {
+            primary.put(key(i), val(i));
+        }
+    }
+    LSMKVStore secondary(secondary_config);
+    for (size_t i = 0; i < 500; i++) {
+        ASSERT_EQ(secondary.get(key(i)), val(i));
+    }
+    ASSERT_THROW(secondary.put(key(0), "x"), std::logic_error);
+    ASSERT_THROW(secondary.remove(key(0)), std::logic_error);
+    ASSERT_THROW(secondary.remove_range(key(0), key(10)), std::logic_error);
+    ASSERT_EQ(secondary.catch_up(), 0);
+    // catch_up skips loaded tables by the id in their name
+    ASSERT_EQ(SSTable::table_id(dir.directory() / "sstable-12.sst"), 12);
+    ASSERT_EQ(SSTable::table_id(dir.directory() / "sstable-12.sst.tmp"), std::nullopt);
+    ASSERT_EQ(SSTable::table_id(dir.directory() / "sstable-x.sst"), std::nullopt);
+    ASSERT_EQ(SSTable::table_id(dir.directory() / "external.sst"), std::nullopt);
+
+    {
+        LSMKVStore primary(config);
+        for (size_t i = 500; i < 1000; i++) {
+            primary.put(key(i), val(i));
+        }
+        primary.put(key(0), "updated");
+        primary.remove(key(1));
+    }
+    ASSERT_EQ(secondary.get(key(500)), std::nullopt);
+    ASSERT_GT(secondary.catch_up(), 0);
+    ASSERT_EQ(secondary.get(key(0)), "updated");
+    ASSERT_EQ(secondary.get(key(1)), std::nullopt);
+    for (size_t i = 2; i < 1000; i++) {
+        ASSERT_EQ(secondary.get(key(i)), val(i));
+    }
+
+    // a following secondary catches up by itself
+    KVStoreConfig follower_config = secondary_config;
+    follower_config.follow_primary_ = true;
+    LSMKVStore follower(follower_config);
+    {
+        LSMKVStore primary(config);
+        primary.put(key(1000), val(1000));
+    }
+    for (int i = 0; i < 500 && follower.get(key(1000)) != val(1000); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(follower.get(key(1000)), val(1000));
+}
+
+TEST(DB, TEST_COALESCED_FLUSH) {
+    auto name = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+    auto path = std::filesystem::path("./test").append(name);
+    TestDir<Auto> dir(path);
+    auto concat = [](const std::string&, const std::optional<std::string>& base, const std::vector<std::string>& operands) {
+        std::string result = base.value_or("");
+        for (auto& operand: operands) {
+            result += operand;
+        }
+        return result;
+    };
+
+    // newer memtables win over older ones within a single table
+    MemTable<Mutable> oldest(1);
+    oldest.put("a", "1");
+    oldest.put("b", "1");
+    oldest.put("c", "1");
+    oldest.merge("d", "x");
+    oldest.put("r1", "1");
+    MemTable<Mutable> middle(2);
+    middle.put("a", "2");
+    middle.remove_range("r", "s");
+    middle.merge("b", "y");
+    middle.merge("d", "y");
+    middle.merge("e", "y");
+    MemTable<Mutable> newest(3);
+    newest.put("c", "");
+    newest.merge("d", "z");
+    newest.merge("r1", "z");
+    newest.put("r2", "3");
+    auto frozen = std::vector{oldest.freeze(), middle.freeze(), newest.freeze()};
+    std::vector<const MemTable<Immutable>*> memtables;
+    for (auto& memtable: frozen) {
+        memtables.push_back(&memtable);
+    }
+    auto table = SSTable::from_memtables(3, dir.directory(), memtables, concat);
+    ASSERT_EQ(table.id(), 3);
+    ASSERT_EQ(table.get("a")->value, "2");
+    ASSERT_EQ(table.get("b")->value, "1y");
+    ASSERT_EQ(table.get("c")->value, "");
+    // the operands have no base in these memtables, so they stay unresolved for older tables
+    ASSERT_FALSE(table.get("d")->value.has_value());
+    ASSERT_EQ(table.get("d")->operands, (std::vector<std::string>{"x", "y", "z"}));
+    ASSERT_EQ(table.get("e")->operands, (std::vector<std::string>{"y"}));
+    // the range tombstone is the base for newer operands and hides older values
+    ASSERT_EQ(table.get("r1")->value, "z");
+    ASSERT_EQ(table.get("r2")->value, "3");
+    ASSERT_EQ(table.get("r3")->value, "");
+
+    // memtables frozen while a flush runs are all written by the next one
+    auto db_path = dir.directory() / "db";
+    auto key = [](size_t i) {return std::format("key{:05d}", i); };
+    auto val = [](size_t i) {return std::format("value{:05d}", i); };
+    constexpr int keys = 2000;
+    KVStoreConfig config(512, db_path);
+    config.background_threads_ = 1;
+    // holds up the first flush that collapses operands, until release is set
+    auto writer_thread = std::this_thread::get_id();
+    std::atomic<bool> gated = true;
+    std::promise<void> entered, release;
+    auto released = release.get_future().share();
+    config.merge_operator_ = [&](const std::string& k, const std::optional<std::string>& base,
+                                 const std::vector<std::string>& operands) {
+        if (std::this_thread::get_id() != writer_thread && gated.exchange(false)) {
+            entered.set_value();
+            released.wait();
+        }
+        return concat(k, base, operands);
+    };
+    {
+        LSMKVStore db(config);
+        db.put(key(0), val(0));
+        db.merge(key(0), "+");
+        size_t i = 1;
+        for (; db.memory_usage().immutable_memtables == 0; i++) {
+            db.put(key(i), val(i));
+        }
+        entered.get_future().wait();
+        // the flush does not hold up writers, which freeze many more memtables meanwhile
+        for (; i < keys; i++) {
+            db.put(key(i), val(i));
+        }
+        for (i = 2; i < keys; i += 2) {
+            db.merge(key(i), "+");
+        }
+        db.remove_range(key(100), key(200));
+        EXPECT_GT(db.memory_usage().immutable_memtables, 0);
+        release.set_value();
+        while (db.memory_usage().immutable_memtables > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        // one table from the gated flush, one from everything queued behind it
+        size_t tables = std::distance(std::filesystem::directory_iterator(db_path), std::filesystem::directory_iterator{});
+        ASSERT_EQ(tables, 2);
+    }
+    {
+        LSMKVStore db(config);
+        for (size_t i = 0; i < keys; i++) {
+            if (i >= 100 && i < 200) {
+                ASSERT_EQ(db.get(key(i)), std::nullopt);
+            } else {
+                ASSERT_EQ(db.get(key(i)), i % 2 == 0 ? val(i) + "+" : val(i));
+            }
+        }
+    }
+}
+
+TEST(DB, TEST_U64_KEYS) {
+    auto name = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+    auto path = std::filesystem::path("./test").append(name);
+    TestDir<Auto> dir(path);
+    auto val = [](uint64_t i) {return std::format("value{0}", i); };
+    // spread over the whole range so byte order and numeric order would differ for little-endian keys
+    auto key = [](uint64_t i) {return i * 0x9E3779B97F4A7C15ull >> 8; };
+    constexpr int keys = 2000;
+    KVStoreConfig config(512, dir.directory() / "db");
+    config.block_size_ = MIN_BLOCK_SIZE;
+    config.merge_operator_ = [](const std::string&, const std::optional<std::string>& base, const std::vector<std::string>& operands) {
+        std::string result = base.value_or("");
+        for (auto& operand: operands) {
+            result += operand;
+        }
+        return result;
+    };
+    {
+        U64KVStore db(config);
+        for (uint64_t i = 0; i < keys; i++) {
+            db.put(key(i), val(i));
+        }
+        for (uint64_t i = 0; i < keys; i += 3) {
+            db.merge(key(i), "+");
+        }
+        db.remove(key(1));
+        db.remove_range(1ull << 54, 1ull << 56);
+        db.put(1ull << 55, "inside");
+        ASSERT_EQ(db.get(1ull << 55), "inside");
+    }
+    size_t removed = std::ranges::count_if(std::views::iota(0, keys), [&](uint64_t i) {
+        return key(i) >= (1ull << 54) && key(i) < (1ull << 56);
+    });
+    ASSERT_GT(removed, 0);
+
+    // a table with many blocks exercises the integer block index
+    auto external = dir.directory() / "external.sst";
+    {
+        BasicSSTableWriter<U64Key> writer(external, 0, MIN_BLOCK_SIZE);
+        for (uint64_t i = 0; i < 5000; i++) {
+            writer.add(i * 2 + 1, val(i));
+        }
+        auto table = writer.finish();
+        for (uint64_t i = 0; i < 5000; i++) {
+            ASSERT_EQ(table.get(i * 2 + 1)->value, val(i));
+            ASSERT_EQ(table.get(i * 2), std::nullopt);
+        }
+    }
+
+    {
+        U64KVStore db(config);
+        db.ingest({external});
+        for (uint64_t i = 0; i < keys; i++) {
+            std::optional<std::string> expected = i % 3 == 0 ? val(i) + "+" : val(i);
+            if (i == 1 || (key(i) >= (1ull << 54) && key(i) < (1ull << 56))) {
+                expected = std::nullopt;
+            }
+            ASSERT_EQ(db.get(key(i)), expected);
+        }
+        ASSERT_EQ(db.get(1ull << 55), "inside");
+        ASSERT_EQ(db.get(9999), val(4999));
+        ASSERT_TRUE(db.verify_all().empty());
+    }
+
+    // tables hold encoded keys, so a string store can read them, but not the other way round
+    {
+        LSMKVStore db(config);
+        ASSERT_EQ(db.get(U64Key::encode(1ull << 55)), "inside");
+    }
+    KVStoreConfig string_config(512, dir.directory() / "strings");
+    {
+        LSMKVStore db(string_config);
+        db.put("a", "1");
+    }
+    ASSERT_THROW(U64KVStore{string_config}, CorruptionError);
+    // a key of the wrong width past the first one of a block is caught by reads that walk over it
+    auto mixed = dir.directory() / "mixed.sst";
+    {
+        SSTableWriter writer(mixed);
+        writer.add(U64Key::encode(1), "1");
+        writer.add("b", "2");
+        writer.finish();
+    }
+    auto table = BasicSSTable<U64Key>::from_file(mixed);
+    ASSERT_EQ(table.get(1)->value, "1");
+    ASSERT_THROW(table.get(2), CorruptionError);
+    ASSERT_THROW(table.verify(), CorruptionError);
+}